@@ -0,0 +1,158 @@
+#pragma once
+#include <memory>
+#include "mode_query.cpp"
+
+// One level of a cutting tree: a cutting of the lines crossing a convex cell, clipped to that cell. Faces crossed
+// by more than the leaf size lines are refined by a child node over the lines of their conflict list, so the mode
+// below a query point is found by point location on every level and a scan of a short conflict list at the leaf.
+typedef struct {
+	Arrangement arr;
+	Trapezoid_pl pl;
+	ConflictList cl; // line indices are those of the segments of the tree
+	FaceFrequencies frequencies; // below counts and modes of the leaf faces, over all lines of the tree
+	vec<int> children; // per face, the node refining it, or -1 for a leaf
+} CuttingNode;
+
+typedef struct {
+	vec<Segment_2> segments;
+	vec<unique_ptr<CuttingNode>> nodes; // the root comes first
+	DualTransform transform;
+	Point_2 lower;
+	Point_2 upper;
+} CuttingTree;
+
+// Builds the node refining a convex cell crossed by cell_lines, and its descendants, and returns its index.
+// The state holds the lines fully below the cell, and is left that way.
+static int build_cutting_node(
+	CuttingTree* tree,
+	vec<int>* colors,
+	vec<Point_2>* polygon,
+	vec<int>* cell_lines,
+	int r,
+	int leaf_size,
+	BelowState* state,
+	unsigned int numThreads
+) {
+	int node_index = tree->nodes.size();
+	tree->nodes.push_back(unique_ptr<CuttingNode>(new CuttingNode()));
+	CuttingNode* node = tree->nodes.back().get();
+
+	vec<Segment_2> clipped = {};
+	vec<int> clipped_lines = {};
+	for (int line_index : *cell_lines) {
+		Segment_2 segment;
+		if (clip_to_polygon(tree->segments[line_index], polygon, &segment)) {
+			clipped.push_back(segment);
+			clipped_lines.push_back(line_index);
+		}
+	}
+
+	// arrangement of a random sample of the lines in the cell, along with the boundary of the cell
+	int sample_size = min((int)clipped.size(), (int)(r * log(r) / log(2)));
+	auto arrangement_segments = random_split(&clipped, sample_size).first;
+	for (int i = 0; i < polygon->size(); i++) {
+		arrangement_segments.push_back(Segment_2((*polygon)[i], (*polygon)[(i + 1) % polygon->size()]));
+	}
+	CGAL::insert(node->arr, arrangement_segments.begin(), arrangement_segments.end());
+	triangulate_arrangement(&node->arr);
+
+	node->cl = get_conflict_list(&node->arr, &clipped, numThreads);
+	for (auto& line_index : node->cl.lines) line_index = clipped_lines[line_index];
+
+	int F = node->cl.offsets.size() - 1;
+	node->frequencies = get_face_frequencies(&node->cl, colors, numThreads);
+	node->children.assign(F, -1);
+
+	int root;
+	auto neighbours = get_face_neighbours(&node->arr, F, &root);
+	if (root >= 0) {
+		auto centers = get_face_centers(&node->arr, F);
+		vec<Face_handle> faces(F);
+		for (Face_handle face = node->arr.faces_begin(); face != node->arr.faces_end(); face++) {
+			if (!face->is_unbounded()) faces[face->data().index] = face;
+		}
+
+		FaceFrequencies* ff = &node->frequencies;
+		traverse_faces(&node->cl, &neighbours, &centers, root, cell_lines, state, [&](int face_index) {
+			int begin = node->cl.offsets[face_index], end = node->cl.offsets[face_index + 1];
+
+			// refine faces crossed by too many lines, as long as the sample split up the lines of the cell
+			if (end - begin > leaf_size && end - begin < cell_lines->size()) {
+				vec<int> face_lines(node->cl.lines.begin() + begin, node->cl.lines.begin() + end);
+				auto face_polygon = get_face_polygon(faces[face_index]);
+				node->children[face_index] = build_cutting_node(tree, colors, &face_polygon, &face_lines, r, leaf_size, state, numThreads);
+				return;
+			}
+
+			for (int i = ff->offsets[face_index]; i < ff->offsets[face_index + 1]; i++) {
+				ff->under_counts[i] = state->counts[ff->colors[i]];
+			}
+			ff->below_modes[face_index] = state->mode();
+		});
+	}
+
+	// back to the lines fully below the cell
+	for (int line_index : *cell_lines) state->set(line_index, false);
+	node->pl.attach(node->arr);
+	return node_index;
+}
+
+// Builds a cutting tree over the duals of the normalized points, see preprocess_mode. Every node is an r-cutting of
+// the lines crossing its cell, and faces crossed by more than leaf_size lines get a child node. A smaller leaf size
+// makes queries faster, at the cost of more nodes and a longer preprocessing. Conflict lists are computed on
+// numThreads threads, or one per hardware thread if 0.
+static CuttingTree preprocess_cutting_tree(vec<double>* xs, vec<double>* ys, vec<int>* colors, int r, int leaf_size, unsigned int numThreads = 0) {
+	if (numThreads == 0) numThreads = max(1u, thread::hardware_concurrency());
+
+	// bounding box for arrangement
+	CuttingTree tree;
+	auto dual_box = get_dual_box();
+	tree.lower = dual_box.first;
+	tree.upper = dual_box.second;
+	tree.transform = get_dual_transform(xs, ys);
+	auto lines = get_dual_lines(xs, ys, &tree.transform);
+	tree.segments = get_segments(&lines, tree.lower, tree.upper, false);
+
+	vec<Point_2> box = { tree.lower, Point_2(tree.upper.x(), tree.lower.y()), tree.upper, Point_2(tree.lower.x(), tree.upper.y()) };
+	vec<int> all_lines(tree.segments.size());
+	iota(all_lines.begin(), all_lines.end(), 0);
+	BelowState state(&tree.segments, colors);
+	build_cutting_node(&tree, colors, &box, &all_lines, r, leaf_size, &state, numThreads);
+	return tree;
+}
+
+// Returns the mode color of the lines below q, and its frequency. Unlike query_arrangement, colors that do not
+// cross the face of q are considered too. Ties go to any of the colors.
+static pair<int, int> query_cutting_tree(CuttingTree* tree, Point_2 q) {
+	// descend to the leaf face containing q
+	CuttingNode* node = tree->nodes[0].get();
+	int face_index;
+	while (true) {
+		// points on edges and vertices take one of the faces around them
+		auto result = node->pl.locate(q);
+		face_index = get_located_face(&result);
+		if (face_index < 0) {
+			cout << "Could not locate point " << q << " due to point location not returning a face.";
+			return pair<int, int>(-1, 0);
+		}
+		if (node->children[face_index] < 0) break;
+		node = tree->nodes[node->children[face_index]].get();
+	}
+
+	// start from the lines fully below the face, reusing the buffer of earlier queries on this thread
+	FaceFrequencies* ff = &node->frequencies;
+	int colors_begin = ff->offsets[face_index], colors_end = ff->offsets[face_index + 1];
+	thread_local vec<int> candidate_counts;
+	candidate_counts.assign(ff->under_counts.begin() + colors_begin, ff->under_counts.begin() + colors_end);
+
+	for (int i = node->cl.offsets[face_index]; i < node->cl.offsets[face_index + 1]; i++) {
+		if (is_below(tree->segments[node->cl.lines[i]], q)) candidate_counts[ff->slots[i]]++;
+	}
+
+	// colors that do not cross the face only have lines fully below it
+	pair<int, int> mode = ff->below_modes[face_index];
+	for (int slot = 0; slot < candidate_counts.size(); slot++) {
+		if (candidate_counts[slot] > mode.second) mode = { ff->colors[colors_begin + slot], candidate_counts[slot] };
+	}
+	return mode;
+}
@@ -0,0 +1,286 @@
+#pragma once
+/**
+ * Implements a dynamic RangeTree using the logarithmic method.
+ *
+ * A RangeTree is static: adding a single point requires a full rebuild. The DynamicRangeTree
+ * class keeps a Bentley-Saxe decomposition of the points into static RangeTree's whose sizes are
+ * distinct powers of two, so that an insertion only rebuilds the components it merges. Deletions
+ * are recorded as tombstones in a second decomposition and subtracted at query time; once too
+ * many tombstones have accumulated, everything is rebuilt without the deleted points.
+ *
+ * See
+ *
+ * Jon Louis Bentley and James B. Saxe. 1980. Decomposable searching problems I: Static-to-dynamic
+ * transformation. Journal of Algorithms 1, 4 (1980), 301-358.
+ */
+
+#ifndef DYNAMIC_RANGETREE_H
+#define DYNAMIC_RANGETREE_H
+
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "rangetree.h"
+
+namespace RangeTree {
+
+    /**
+    * A RangeTree that supports insertions and deletions.
+    *
+    * For n stored points, a DynamicRangeTree consists of O(log(n)) static RangeTree's, so queries
+    * cost a factor O(log(n)) more than on a single RangeTree. Insertions take amortized
+    * O(log(n)^d) time. As for RangeTree, all points at the same euclidean position are required
+    * to have the same value.
+    */
+    template <class S>
+    class DynamicRangeTree {
+    private:
+        /**
+        * A static range tree on the points of 2^i insertions, or an empty slot. The tree holds the only copy
+        * of its points, merges read them back with pointsInRange(...) over all of space.
+        */
+        struct Component {
+            std::unique_ptr<RangeTree<S> > tree;
+        };
+
+        std::vector<Component> live; /**< Decomposition of all inserted points **/
+        std::vector<Component> tombstones; /**< Decomposition of all deleted points **/
+        int numLive; /**< Total count of inserted points, including multiplicities **/
+        int numTombstones; /**< Total count of deleted points, including multiplicities **/
+        double rebuildFraction;
+        unsigned int numThreads; /**< Threads used to build each component **/
+        int dim; /**< Dimension of the points, or 0 before the first one **/
+
+        static std::vector<NumTy> key(const RTPoint<S>& point) {
+            std::vector<NumTy> coords(point.dim());
+            for (int i = 0; i < point.dim(); i++) {
+                coords[i] = point[i];
+            }
+            return coords;
+        }
+
+        /**
+        * All points of a component, with points at the same position merged.
+        */
+        std::vector<RTPoint<S> > pointsOf(const Component& component) const {
+            std::vector<NumTy> lower(dim, std::numeric_limits<NumTy>::lowest());
+            std::vector<NumTy> upper(dim, std::numeric_limits<NumTy>::max());
+            return component.tree->pointsInRange(Point_d(lower), Point_d(upper));
+        }
+
+        void insertInto(std::vector<Component>& components, const RTPoint<S>& point) {
+            std::vector<RTPoint<S> > carry = { point };
+            for (int i = 0; ; i++) {
+                if (i == components.size()) {
+                    components.push_back(Component());
+                }
+                if (!components[i].tree) {
+                    components[i].tree = std::unique_ptr<RangeTree<S> >(new RangeTree<S>(std::move(carry), numThreads));
+                    return;
+                }
+                auto points = pointsOf(components[i]);
+                carry.insert(carry.end(), points.begin(), points.end());
+                components[i].tree.reset();
+            }
+        }
+
+        void assign(std::vector<Component>& components, const std::vector<RTPoint<S> >& points) {
+            components.clear();
+            int begin = 0;
+            for (int i = 0; (1 << i) <= points.size(); i++) {
+                components.push_back(Component());
+                if (points.size() & (1 << i)) {
+                    std::vector<RTPoint<S> > slice(points.begin() + begin, points.begin() + begin + (1 << i));
+                    components[i].tree = std::unique_ptr<RangeTree<S> >(new RangeTree<S>(std::move(slice), numThreads));
+                    begin += 1 << i;
+                }
+            }
+        }
+
+        static std::pair<int, int> countIn(const std::vector<Component>& components,
+            const Point_d& lower,
+            const Point_d& upper) {
+            std::pair<int, int> res(0, 0);
+            for (int i = 0; i < components.size(); i++) {
+                if (components[i].tree) {
+                    auto componentRes = components[i].tree->countInRange(lower, upper);
+                    res.first += componentRes.first;
+                    res.second += componentRes.second;
+                }
+            }
+            return res;
+        }
+
+        /**
+        * Merges the points of all components in range by position, with deleted points subtracted.
+        */
+        std::map<std::vector<NumTy>, RTPoint<S> > mergedPointsInRange(const Point_d& lower,
+            const Point_d& upper) const {
+            std::map<std::vector<NumTy>, RTPoint<S> > merged;
+            for (int i = 0; i < live.size(); i++) {
+                if (!live[i].tree) continue;
+                auto points = live[i].tree->pointsInRange(lower, upper);
+                for (int j = 0; j < points.size(); j++) {
+                    auto it = merged.find(key(points[j]));
+                    if (it == merged.end()) {
+                        merged.insert(std::make_pair(key(points[j]), points[j]));
+                    }
+                    else {
+                        it->second.increaseCountBy(points[j].count());
+                    }
+                }
+            }
+
+            std::map<std::vector<NumTy>, int> deleted;
+            for (int i = 0; i < tombstones.size(); i++) {
+                if (!tombstones[i].tree) continue;
+                auto points = tombstones[i].tree->pointsInRange(lower, upper);
+                for (int j = 0; j < points.size(); j++) {
+                    deleted[key(points[j])] += points[j].count();
+                }
+            }
+            for (auto it = deleted.begin(); it != deleted.end(); it++) {
+                auto point = merged.find(it->first);
+                if (point->second.count() == it->second) {
+                    merged.erase(point);
+                }
+                else {
+                    RTPoint<S> remaining(point->second.asLocation(), point->second.value());
+                    remaining.increaseCountBy(point->second.count() - it->second - 1);
+                    point->second = remaining;
+                }
+            }
+            return merged;
+        }
+
+        void rebuild() {
+            std::vector<RTPoint<S> > points;
+            if (numLive > numTombstones) {
+                std::vector<NumTy> lower(dim, std::numeric_limits<NumTy>::lowest());
+                std::vector<NumTy> upper(dim, std::numeric_limits<NumTy>::max());
+                auto merged = mergedPointsInRange(Point_d(lower), Point_d(upper));
+                for (auto it = merged.begin(); it != merged.end(); it++) {
+                    points.push_back(it->second);
+                }
+            }
+            assign(live, points);
+            tombstones.clear();
+            numLive -= numTombstones;
+            numTombstones = 0;
+        }
+
+    public:
+        /**
+        * Construct an empty DynamicRangeTree.
+        *
+        * @param rebuildFraction all components are rebuilt once the deleted points make up more than this
+        *                        fraction of the inserted points.
+        * @param numThreads the number of threads to build each component with, see RangeTree. Most components
+        *                   are small, so the default of one thread avoids starting threads on every insertion.
+        */
+        DynamicRangeTree(double rebuildFraction = 0.5, unsigned int numThreads = 1) :
+            numLive(0), numTombstones(0), rebuildFraction(rebuildFraction), numThreads(numThreads), dim(0) {}
+
+        /**
+        * Construct a DynamicRangeTree from input points.
+        *
+        * @param points the initial points.
+        * @param rebuildFraction see DynamicRangeTree(double, unsigned int).
+        * @param numThreads see DynamicRangeTree(double, unsigned int).
+        */
+        DynamicRangeTree(const std::vector<RTPoint<S> >& points, double rebuildFraction = 0.5, unsigned int numThreads = 1) :
+            numLive(0), numTombstones(0), rebuildFraction(rebuildFraction), numThreads(numThreads),
+            dim(points.empty() ? 0 : points[0].dim()) {
+            assign(live, points);
+            for (int i = 0; i < points.size(); i++) {
+                numLive += points[i].count();
+            }
+        }
+
+        /**
+        * Insert a point.
+        *
+        * @param point the point to insert, its multiplicity/count is taken into account.
+        */
+        void insert(const RTPoint<S>& point) {
+            dim = point.dim();
+            insertInto(live, point);
+            numLive += point.count();
+        }
+
+        /**
+        * Remove a single copy of the point at the given position.
+        *
+        * @param location the position of the point to remove.
+        * @return true if a point was removed, false if there is no point at \location.
+        */
+        bool remove(const Point_d& location) {
+            auto merged = mergedPointsInRange(location, location);
+            if (merged.empty()) {
+                return false;
+            }
+            insertInto(tombstones, RTPoint<S>(location, merged.begin()->second.value()));
+            numTombstones++;
+            if (numTombstones > rebuildFraction * numLive) {
+                rebuild();
+            }
+            return true;
+        }
+
+        /**
+        * Total count of points, including multiplicities.
+        */
+        int totalPoints() const {
+            return numLive - numTombstones;
+        }
+
+        /**
+        * The number of points within a high dimensional rectangle, see RangeTree::countInRange(...).
+        *
+        * @param lower the lower bounds of the rectangle.
+        * @param upper the upper bounds of the rectangle.
+        * @return the number of points in the rectangle, number of binary searches to get there.
+        */
+        std::pair<int, int> countInRange(const Point_d& lower,
+            const Point_d& upper) const {
+            if (lower.dimension() != upper.dimension()) {
+                throw std::logic_error("upper and lower in countInRange must have the same length.");
+            }
+            auto liveRes = countIn(live, lower, upper);
+            auto deletedRes = countIn(tombstones, lower, upper);
+            return std::pair<int, int>(liveRes.first - deletedRes.first, liveRes.second + deletedRes.second);
+        }
+
+        /**
+        * Return all points in range, see RangeTree::pointsInRange(...).
+        *
+        * Points at the same position are merged into one point, even if they were inserted separately.
+        *
+        * @param lower the lower bounds of the rectangle.
+        * @param upper the upper bounds of the rectangle.
+        * @return a std::vector of the Points.
+        */
+        std::vector<RTPoint<S> > pointsInRange(const Point_d& lower,
+            const Point_d& upper) const {
+            if (lower.dimension() != upper.dimension()) {
+                throw std::logic_error("All vectors inputted to pointsInRange must have the same length.");
+            }
+            for (int i = 0; i < lower.dimension(); i++) {
+                if (lower[i] > upper[i]) {
+                    return std::vector<RTPoint<S> >();
+                }
+            }
+            auto merged = mergedPointsInRange(lower, upper);
+            std::vector<RTPoint<S> > pointsToReturn;
+            for (auto it = merged.begin(); it != merged.end(); it++) {
+                pointsToReturn.push_back(it->second);
+            }
+            return pointsToReturn;
+        }
+    };
+
+} // namespace
+
+#endif //DYNAMIC_RANGETREE_H
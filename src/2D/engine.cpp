@@ -0,0 +1,161 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "range_query.cpp"
+#include "kd_tree.cpp"
+
+namespace N2D {
+	enum class EngineType { RangeTree, KdTree };
+
+	// Answers k-nearest queries on a fixed set of colored points.
+	// The point store passed to an engine must outlive it.
+	class Engine {
+	public:
+		virtual ~Engine() {}
+
+		// Returns the smallest L-infinity radius around q that contains at least k points
+		virtual NumTy query_k_nearest(Point_d q, int k) = 0;
+
+		// The hint is an L-infinity radius from a nearby query, engines may use it to speed up the search
+		virtual NearestResult query_k_nearest_mode(Point_d q, int k, Metric metric, NumTy hint = 0) = 0;
+	};
+
+	// Counts points in boxes with a range tree and searches the radius over the sorted coordinates of the store
+	class RangeTreeEngine : public Engine {
+	private:
+		PointStore* store;
+		RangeTree::RangeTree<Id> tree;
+		DuplicateIds duplicates;
+
+	public:
+		RangeTreeEngine(PointStore* store) :
+			store(store), tree(generate_tree(store)), duplicates(generate_duplicate_ids(store)) {}
+
+		NumTy query_k_nearest(Point_d q, int k) override {
+			return N2D::query_k_nearest(&tree, &store->sorted_x, &store->sorted_y, q, k);
+		}
+
+		NearestResult query_k_nearest_mode(Point_d q, int k, Metric metric, NumTy hint = 0) override {
+			return N2D::query_k_nearest_mode(&tree, &store->sorted_x, &store->sorted_y, &duplicates, &store->colors, q, k, metric, hint);
+		}
+	};
+
+	// Finds the k nearest points directly with an implicit kd-tree, in linear memory
+	class KdTreeEngine : public Engine {
+	private:
+		PointStore* store;
+		KdTree tree;
+
+	public:
+		KdTreeEngine(PointStore* store) : store(store), tree(generate_kd_tree(store)) {}
+
+		NumTy query_k_nearest(Point_d q, int k) override {
+			return N2D::query_k_nearest_mode(&tree, &store->colors, q, k, Metric::LInfinity).radius;
+		}
+
+		NearestResult query_k_nearest_mode(Point_d q, int k, Metric metric, NumTy hint = 0) override {
+			return N2D::query_k_nearest_mode(&tree, &store->colors, q, k, metric);
+		}
+	};
+
+	static std::unique_ptr<Engine> create_engine(EngineType type, PointStore* store) {
+		switch (type) {
+		case EngineType::KdTree:
+			return std::unique_ptr<Engine>(new KdTreeEngine(store));
+		default:
+			return std::unique_ptr<Engine>(new RangeTreeEngine(store));
+		}
+	}
+
+	// Returns radius from q, using whichever engine was chosen at runtime
+	static NumTy query_k_nearest(Engine* engine, Point_d q, int k) {
+		return engine->query_k_nearest(q, k);
+	}
+
+	// Queries are handed to the workers in chunks of consecutive queries along the Morton curve
+	static const int BATCH_CHUNK_SIZE = 64;
+
+	// Interleaves the bits of x and y, such that nearby points mostly get nearby codes
+	static uint64_t get_morton_code(uint32_t x, uint32_t y) {
+		uint64_t code = 0;
+		for (int i = 0; i < 32; i++) {
+			code |= (uint64_t)(x >> i & 1) << (2 * i);
+			code |= (uint64_t)(y >> i & 1) << (2 * i + 1);
+		}
+		return code;
+	}
+
+	// Returns the indices of the points, sorted along the Morton curve through their bounding box
+	static std::vector<int> get_morton_order(std::vector<Point_d>* points) {
+		std::vector<int> order(points->size());
+		if (points->empty()) return order;
+
+		NumTy min_x = (*points)[0].x(), max_x = min_x, min_y = (*points)[0].y(), max_y = min_y;
+		for (auto& point : *points) {
+			min_x = std::min(min_x, point.x());
+			max_x = std::max(max_x, point.x());
+			min_y = std::min(min_y, point.y());
+			max_y = std::max(max_y, point.y());
+		}
+
+		const NumTy cells = (1 << 16) - 1;
+		NumTy scale_x = max_x > min_x ? cells / (max_x - min_x) : 0;
+		NumTy scale_y = max_y > min_y ? cells / (max_y - min_y) : 0;
+
+		std::vector<std::pair<uint64_t, int>> codes(points->size());
+		for (int i = 0; i < points->size(); i++) {
+			auto x = (uint32_t)(((*points)[i].x() - min_x) * scale_x);
+			auto y = (uint32_t)(((*points)[i].y() - min_y) * scale_y);
+			codes[i] = { get_morton_code(x, y), i };
+		}
+		std::sort(codes.begin(), codes.end());
+
+		for (int i = 0; i < codes.size(); i++) {
+			order[i] = codes[i].second;
+		}
+		return order;
+	}
+
+	// Answers all queries with numThreads workers, or one per hardware thread if 0, and returns the results in the
+	// order of the queries. Queries are sorted along a Morton curve, so each chunk covers a small area: the engine
+	// touches the same part of its data, and each query passes its radius as hint to the next one.
+	static std::vector<NearestResult> batch_query_k_nearest_mode(
+		Engine* engine,
+		std::vector<Point_d>* queries,
+		int k,
+		Metric metric = Metric::LInfinity,
+		unsigned int numThreads = 0
+	) {
+		std::vector<NearestResult> results(queries->size());
+		auto order = get_morton_order(queries);
+
+		std::atomic<int> next_chunk(0);
+		auto worker = [&]() {
+			while (true) {
+				int begin = next_chunk.fetch_add(BATCH_CHUNK_SIZE);
+				if (begin >= (int)order.size()) return;
+
+				int end = std::min(begin + BATCH_CHUNK_SIZE, (int)order.size());
+				NumTy hint = 0;
+				for (int i = begin; i < end; i++) {
+					results[order[i]] = engine->query_k_nearest_mode((*queries)[order[i]], k, metric, hint);
+					if (metric == Metric::LInfinity) hint = results[order[i]].radius;
+				}
+			}
+		};
+
+		if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<std::thread> workers = {};
+		for (unsigned int i = 1; i < numThreads; i++) {
+			workers.push_back(std::thread(worker));
+		}
+		worker();
+		for (auto& thread : workers) {
+			thread.join();
+		}
+		return results;
+	}
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// Counters and timers for the 2D query engines and the preprocessing of the mode structures.
+// Instrumentation is compiled in only if INSTRUMENT_2D is defined before this file is included, otherwise
+// all INSTRUMENT_* macros expand to nothing. When compiled in, it can still be switched off at runtime
+// with Instrumentation::set_enabled(false), which reduces every macro to a single relaxed load.
+//#define INSTRUMENT_2D
+
+namespace Instrumentation {
+	enum Counter {
+		RadiusSearches,
+		RadiusSearchIterations,
+		RangeCounts,
+		RadiusSearchTime, // ns
+		CuttingAttempts,
+		CuttingRefinements,
+		CuttingMaxConflicts, // maximum, not a sum
+		NUM_COUNTERS,
+	};
+
+	inline const char* get_counter_name(Counter counter) {
+		static const char* names[NUM_COUNTERS] = {
+			"radius searches",
+			"radius search iterations",
+			"range counts",
+			"radius search time (ns)",
+			"cutting attempts",
+			"cutting refinements",
+			"cutting max conflict list size",
+		};
+		return names[counter];
+	}
+
+	// Counters that hold the largest value recorded, rather than the sum of all amounts
+	inline bool is_max_counter(Counter counter) {
+		static const bool is_max[NUM_COUNTERS] = {
+			false,
+			false,
+			false,
+			false,
+			false,
+			false,
+			true,
+		};
+		return is_max[counter];
+	}
+
+	inline long long combine(Counter counter, long long a, long long b) {
+		return is_max_counter(counter) ? std::max(a, b) : a + b;
+	}
+
+	// Counters of a single thread. Only the owning thread writes them, so relaxed atomics suffice.
+	struct ThreadCounters {
+		std::atomic<long long> values[NUM_COUNTERS];
+
+		ThreadCounters();
+		~ThreadCounters();
+	};
+
+	// All live thread counters, along with the totals of threads that have already exited.
+	struct Registry {
+		std::mutex mutex;
+		std::vector<ThreadCounters*> threads;
+		long long retired[NUM_COUNTERS] = {};
+		std::atomic<bool> enabled{ true };
+	};
+
+	// Functions here are inline rather than static, such that all translation units including this file share one
+	// registry, which the inline constructor and destructor of ThreadCounters rely on.
+	inline Registry& get_registry() {
+		static Registry registry;
+		return registry;
+	}
+
+	inline ThreadCounters::ThreadCounters() {
+		for (int i = 0; i < NUM_COUNTERS; i++) values[i].store(0, std::memory_order_relaxed);
+		Registry& registry = get_registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.threads.push_back(this);
+	}
+
+	inline ThreadCounters::~ThreadCounters() {
+		Registry& registry = get_registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			registry.retired[i] = combine((Counter)i, registry.retired[i], values[i].load(std::memory_order_relaxed));
+		}
+		for (int i = 0; i < registry.threads.size(); i++) {
+			if (registry.threads[i] == this) {
+				registry.threads.erase(registry.threads.begin() + i);
+				break;
+			}
+		}
+	}
+
+	inline ThreadCounters& get_thread_counters() {
+		thread_local ThreadCounters counters;
+		return counters;
+	}
+
+	inline bool is_enabled() {
+		return get_registry().enabled.load(std::memory_order_relaxed);
+	}
+
+	inline void set_enabled(bool enabled) {
+		get_registry().enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	inline void add(Counter counter, long long amount) {
+		if (!is_enabled()) return;
+		auto& value = get_thread_counters().values[counter];
+		value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	// Raises a max counter to value, if it is larger
+	inline void record_max(Counter counter, long long value) {
+		if (!is_enabled()) return;
+		auto& current = get_thread_counters().values[counter];
+		if (value > current.load(std::memory_order_relaxed)) current.store(value, std::memory_order_relaxed);
+	}
+
+	// Sums the counters of all threads, or takes their maximum for max counters
+	inline std::vector<long long> aggregate() {
+		Registry& registry = get_registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		std::vector<long long> totals(registry.retired, registry.retired + NUM_COUNTERS);
+		for (auto thread : registry.threads) {
+			for (int i = 0; i < NUM_COUNTERS; i++) {
+				totals[i] = combine((Counter)i, totals[i], thread->values[i].load(std::memory_order_relaxed));
+			}
+		}
+		return totals;
+	}
+
+	inline void reset() {
+		Registry& registry = get_registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (int i = 0; i < NUM_COUNTERS; i++) registry.retired[i] = 0;
+		for (auto thread : registry.threads) {
+			for (int i = 0; i < NUM_COUNTERS; i++) thread->values[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	inline void print(std::ostream& out) {
+		auto totals = aggregate();
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			out << get_counter_name((Counter)i) << ": " << totals[i] << std::endl;
+		}
+	}
+
+	// Adds the time between construction and destruction to a counter
+	class ScopedTimer {
+	private:
+		Counter counter;
+		bool enabled;
+		std::chrono::steady_clock::time_point start;
+
+	public:
+		ScopedTimer(Counter counter) : counter(counter), enabled(is_enabled()) {
+			if (enabled) start = std::chrono::steady_clock::now();
+		}
+
+		~ScopedTimer() {
+			if (enabled) {
+				add(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			}
+		}
+	};
+}
+
+#ifdef INSTRUMENT_2D
+#define INSTRUMENT_COUNT(counter, amount) Instrumentation::add(Instrumentation::counter, amount)
+#define INSTRUMENT_TIME(counter) Instrumentation::ScopedTimer instrument_timer_##counter(Instrumentation::counter)
+#define INSTRUMENT_MAX(counter, value) Instrumentation::record_max(Instrumentation::counter, value)
+#else
+#define INSTRUMENT_COUNT(counter, amount)
+#define INSTRUMENT_TIME(counter)
+#define INSTRUMENT_MAX(counter, value)
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include "range_query.cpp"
+
+namespace N2D {
+	// An implicit kd-tree: the points are permuted such that every range [begin, end) holds the median along its
+	// split dimension at its middle, with smaller coordinates before and larger coordinates after it. The tree
+	// itself is not stored, and the coordinates are kept in separate arrays so scanning a leaf stays cache friendly.
+	typedef struct {
+		std::vector<NumTy> xs;
+		std::vector<NumTy> ys;
+		std::vector<Id> ids;
+	} KdTree;
+
+	// Ranges of at most this many points are scanned instead of split further
+	static const int KD_LEAF_SIZE = 16;
+
+	// The k best candidates found so far, as a max-heap with the worst one in front
+	typedef std::vector<std::pair<NumTy, Id>> CandidateHeap;
+
+	static void split_kd_range(PointStore* store, std::vector<Id>* order, int begin, int end, uint dim) {
+		if (end - begin <= KD_LEAF_SIZE) return;
+
+		auto coords = dim == 0 ? &store->xs : &store->ys;
+		int middle = begin + (end - begin) / 2;
+		std::nth_element(order->begin() + begin, order->begin() + middle, order->begin() + end, [&](Id a, Id b) {
+			return (*coords)[a] < (*coords)[b];
+		});
+		split_kd_range(store, order, begin, middle, 1 - dim);
+		split_kd_range(store, order, middle + 1, end, 1 - dim);
+	}
+
+	static KdTree generate_kd_tree(PointStore* store) {
+		std::vector<Id> order(store->xs.size());
+		std::iota(order.begin(), order.end(), 0);
+		split_kd_range(store, &order, 0, order.size(), 0);
+
+		KdTree tree = { std::vector<NumTy>(order.size()), std::vector<NumTy>(order.size()), order };
+		for (int i = 0; i < order.size(); i++) {
+			tree.xs[i] = store->xs[order[i]];
+			tree.ys[i] = store->ys[order[i]];
+		}
+		return tree;
+	}
+
+	static void offer_candidate(CandidateHeap* best, int k, std::pair<NumTy, Id> candidate) {
+		if (best->size() < k) {
+			best->push_back(candidate);
+			std::push_heap(best->begin(), best->end());
+		}
+		else if (candidate < best->front()) {
+			std::pop_heap(best->begin(), best->end());
+			best->back() = candidate;
+			std::push_heap(best->begin(), best->end());
+		}
+	}
+
+	// Visits the side of every split containing q first, and the other side only if it may still hold a better
+	// candidate. The distance to the split line bounds the distance to all points across it in both metrics.
+	static void search_kd_range(KdTree* tree, int begin, int end, uint dim, Point_d q, int k, Metric metric, CandidateHeap* best) {
+		if (end - begin <= KD_LEAF_SIZE) {
+			for (int i = begin; i < end; i++) {
+				offer_candidate(best, k, { get_distance(tree->xs[i] - q.x(), tree->ys[i] - q.y(), metric), tree->ids[i] });
+			}
+			return;
+		}
+
+		int middle = begin + (end - begin) / 2;
+		offer_candidate(best, k, { get_distance(tree->xs[middle] - q.x(), tree->ys[middle] - q.y(), metric), tree->ids[middle] });
+
+		NumTy offset = q[dim] - (dim == 0 ? tree->xs[middle] : tree->ys[middle]);
+		if (offset < 0) {
+			search_kd_range(tree, begin, middle, 1 - dim, q, k, metric, best);
+			// equal distances are still visited, since a smaller id wins the tie
+			if (best->size() < k || -offset <= best->front().first) {
+				search_kd_range(tree, middle + 1, end, 1 - dim, q, k, metric, best);
+			}
+		}
+		else {
+			search_kd_range(tree, middle + 1, end, 1 - dim, q, k, metric, best);
+			if (best->size() < k || offset <= best->front().first) {
+				search_kd_range(tree, begin, middle, 1 - dim, q, k, metric, best);
+			}
+		}
+	}
+
+	// Returns the k nearest points to q and the mode of their colors, see query_k_nearest_mode on a range tree
+	static NearestResult query_k_nearest_mode(KdTree* tree, std::vector<Color>* colors, Point_d q, int k, Metric metric = Metric::LInfinity) {
+		// reused across queries on the same thread
+		thread_local CandidateHeap best;
+		best.clear();
+		if (k > 0) search_kd_range(tree, 0, tree->ids.size(), 0, q, k, metric, &best);
+
+		std::sort_heap(best.begin(), best.end());
+		return select_nearest(&best, colors, k);
+	}
+}
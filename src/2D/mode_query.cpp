@@ -1,8 +1,13 @@
 #pragma once
 #include <vector>
-#include <set>
 #include <algorithm>
+#include <numeric>
 #include <random>
+#include <variant>
+#include <thread>
+#include <cmath>
+#include <cfloat>
+#include <stdexcept>
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Arr_non_caching_segment_traits_2.h>
 #include <CGAL/Arr_extended_dcel.h>
@@ -15,16 +20,42 @@
 #include <CGAL/Segment_2.h>
 #include <CGAL/draw_arrangement_2.h>
 #include <CGAL/Arr_trapezoid_ric_point_location.h>
+#include <CGAL/Arr_observer.h>
+#include "instrumentation.h"
 
 using namespace std;
 
 template<class T>
 using vec = vector<T>;
-typedef vec<set<int>> ConflictList;
+// Conflict lists of all faces in compressed sparse row form: the lines intersecting face f are
+// lines[offsets[f]] up to lines[offsets[f + 1]], in increasing order
+typedef struct {
+	vec<int> offsets;
+	vec<int> lines;
+} ConflictList;
+// The distinct colors of the conflict list of face f are colors[offsets[f]] up to colors[offsets[f + 1]], in
+// increasing order, with under_counts holding the number of lines of that color fully below the face.
+// slots is parallel to the lines of the conflict list, and holds the position of the color of each line within
+// the colors of its face. below_modes holds per face a color with the most lines fully below it, which accounts
+// for the colors that do not cross the face.
+typedef struct {
+	vec<int> offsets;
+	vec<int> colors;
+	vec<int> under_counts;
+	vec<int> slots;
+	vec<pair<int, int>> below_modes;
+} FaceFrequencies;
+// The segments of the conflict lists, in the order of their lines, as their lexicographically smallest endpoint
+// (px, py) and the difference (dx, dy) to the other one. A segment lies below q exactly if q is a left turn from it.
+typedef struct {
+	vec<double> px;
+	vec<double> py;
+	vec<double> dx;
+	vec<double> dy;
+} PackedLines;
+// Faces created by splitting a face get index -1, except during refine_cutting
 typedef struct { 
-	int index;
-	pair<int, int> mode; 
-	map<int, int> under_frequencies;
+	int index = -1;
 } FaceData;
 typedef CGAL::Exact_predicates_inexact_constructions_kernel Kernel;
 typedef CGAL::Arr_non_caching_segment_traits_2<Kernel> Traits;
@@ -40,13 +71,29 @@ typedef CGAL::Line_2<Kernel> Line_2;
 typedef CGAL::Segment_2<Kernel> Segment_2;
 using Point_location_result = CGAL::Arr_point_location_result<Arrangement>;
 using Query_result = std::pair<Point_2, Point_location_result::Type>;
+// Maps the points into [-1, 1]^2 by one scale for both axes, which keeps slopes. The point (x, y) then becomes
+// (x', y') = ((x - center_x) / scale, (y - center_y) / scale).
+typedef struct {
+	double center_x;
+	double center_y;
+	double scale;
+} DualTransform;
 typedef struct {
 	vec<Segment_2> segments;
 	Arrangement arr;
 	ConflictList cl;
+	FaceFrequencies frequencies;
+	PackedLines packed;
+	DualTransform transform;
 	Point_2 lower;
 	Point_2 upper;
+	bool valid; // whether every conflict list has at most 1.2 N / r lines, see preprocess_dual_lines
 } ModeData;
+// A candidate cutting: the arrangement of a random sample of the lines, and the conflict lists of its faces
+typedef struct {
+	Arrangement arr;
+	ConflictList cl;
+} Cutting;
 
 
 template<class T>
@@ -62,15 +109,71 @@ static pair<vec<T>, vec<T>> random_split(vec<T>* input, int left_count) {
 	return pair<vec<T>, vec<T>>(left, right);
 }
 
-static vec<Line_2> get_dual_lines(vec<Point_2>* locations) {
-	vec<Line_2> dual_lines(locations->size());
-	for (int i = 0; i < locations->size(); i++) {
-		auto loc = (*locations)[i];
-		dual_lines[i] = Line_2(loc.y(), loc.x(), -1);
+// Splits [0, n) into parts contiguous ranges and runs body(part, begin, end) for each of them on its own thread
+template<class Body>
+static void parallel_for_parts(int n, unsigned int parts, Body body) {
+	auto part_begin = [&](unsigned int part) { return (int)((long long)n * part / parts); };
+	vec<thread> workers = {};
+	for (unsigned int part = 1; part < parts; part++) {
+		workers.push_back(thread(body, part, part_begin(part), part_begin(part + 1)));
+	}
+	body(0, 0, part_begin(1));
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+// Query lines may have slopes up to this in absolute value, the arrangement box spans these slopes
+static const double MAX_QUERY_SLOPE = 1;
+
+static DualTransform get_dual_transform(vec<double>* xs, vec<double>* ys) {
+	if (xs->empty()) return DualTransform{ 0, 0, 1 };
+
+	auto x_range = minmax_element(xs->begin(), xs->end());
+	auto y_range = minmax_element(ys->begin(), ys->end());
+	double scale = max(*x_range.second - *x_range.first, *y_range.second - *y_range.first) / 2;
+	return DualTransform{
+		(*x_range.first + *x_range.second) / 2,
+		(*y_range.first + *y_range.second) / 2,
+		scale > 0 ? scale : 1,
+	};
+}
+
+// Returns the box of the dual arrangement. The dual line y = x' X - y' of a transformed point stays within
+// |y| <= MAX_QUERY_SLOPE + 1 for |X| <= MAX_QUERY_SLOPE, so every dual line crosses the box from its left to its
+// right side, and no part of the arrangement lies outside the range of the queries.
+static pair<Point_2, Point_2> get_dual_box() {
+	return pair<Point_2, Point_2>(
+		Point_2(-MAX_QUERY_SLOPE, -MAX_QUERY_SLOPE - 2),
+		Point_2(MAX_QUERY_SLOPE, MAX_QUERY_SLOPE + 2)
+	);
+}
+
+// The point (x, y) becomes the dual line y = x' X - y' of its transformed coordinates. A point lies above a
+// primal line y = m x + t exactly if its dual line lies below the dual point (m, -t) of that line.
+static vec<Line_2> get_dual_lines(vec<double>* xs, vec<double>* ys, DualTransform* transform) {
+	vec<Line_2> dual_lines(xs->size());
+	for (int i = 0; i < xs->size(); i++) {
+		double x = ((*xs)[i] - transform->center_x) / transform->scale;
+		double y = ((*ys)[i] - transform->center_y) / transform->scale;
+		dual_lines[i] = Line_2(x, -1, -y);
 	}
 	return dual_lines;
 }
 
+// Returns the dual query point of the primal line y = slope x + intercept, in the original coordinates. The lines
+// below it are the duals of the points above the primal line. Lines above or below all points are moved to just
+// inside the box, which keeps their answer. The box only holds the duals of slopes up to MAX_QUERY_SLOPE, steeper
+// lines are rejected rather than answered for another line.
+static Point_2 get_dual_query(DualTransform* transform, double slope, double intercept) {
+	if (fabs(slope) > MAX_QUERY_SLOPE) {
+		throw std::logic_error("Mode queries only support lines with slopes up to MAX_QUERY_SLOPE in absolute value");
+	}
+	double t = (slope * transform->center_x + intercept - transform->center_y) / transform->scale;
+	double limit = MAX_QUERY_SLOPE + 1.5;
+	return Point_2(slope, max(-limit, min(limit, -t)));
+}
+
 // Returns a set of line segments that have been clamped to the bounding box provided by lower and upper
 static vec<Segment_2> get_segments(vec<Line_2>* lines, Point_2 lower_left, Point_2 upper_right, bool include_boundaries) {
 	vec<Segment_2> segments = {};
@@ -141,11 +244,83 @@ static void triangulate_arrangement(Arrangement* arr) {
 	}
 }
 
+// Returns the corners of a bounded face, in order
+static vec<Point_2> get_face_polygon(Face_handle face) {
+	vec<Point_2> polygon = {};
+	Halfedge_handle start = *face->outer_ccbs_begin();
+	Halfedge_handle curr = start;
+	do {
+		polygon.push_back(curr->target()->point());
+		curr = curr->next();
+	} while (curr != start);
+	return polygon;
+}
+
+// Clips the line through a segment to a convex polygon, returns false if the line misses the polygon
+static bool clip_to_polygon(const Segment_2& segment, vec<Point_2>* polygon, Segment_2* clipped) {
+	auto line = segment.supporting_line();
+	vec<Point_2> points = {};
+	for (int i = 0; i < polygon->size(); i++) {
+		Segment_2 edge((*polygon)[i], (*polygon)[(i + 1) % polygon->size()]);
+		auto result = CGAL::intersection(line, edge);
+		if (!result) continue;
+
+		if (const Point_2* p = get_if<Point_2>(&*result)) {
+			points.push_back(*p);
+		}
+		else if (const Segment_2* s = get_if<Segment_2>(&*result)) {
+			points.push_back(s->source());
+			points.push_back(s->target());
+		}
+	}
+	if (points.size() < 2) return false;
+
+	auto extremes = minmax_element(points.begin(), points.end());
+	if (*extremes.first == *extremes.second) return false;
+	*clipped = Segment_2(*extremes.first, *extremes.second);
+	return true;
+}
+
+// Output iterator for CGAL::zone that collects the indices of the faces a segment touches.
+// The zone reports the vertices, edges and faces a segment passes through. A segment that passes through a vertex
+// or along an edge also touches the boundary of the faces around it, so those count as intersected as well.
+struct ConflictCollector {
+	vec<int>* faces;
+
+	ConflictCollector& operator*() { return *this; }
+	ConflictCollector& operator++() { return *this; }
+	ConflictCollector& operator++(int) { return *this; }
+
+	template<class T>
+	ConflictCollector& operator=(const T& element) {
+		std::visit([this](auto&& handle) { add(handle); }, element);
+		return *this;
+	}
+
+	void add(Face_handle face) {
+		if (!face->is_unbounded()) faces->push_back(face->data().index);
+	}
+
+	void add(Halfedge_handle halfedge) {
+		add(halfedge->face());
+		add(halfedge->twin()->face());
+	}
+
+	void add(Vertex_handle vertex) {
+		auto start = vertex->incident_halfedges();
+		auto curr = start;
+		do {
+			add(curr->face());
+		} while (++curr != start);
+	}
+};
+
 // Returns a set of intersecting lines per face.
-static ConflictList get_conflict_list(Arrangement* arr, vec<Segment_2>* rest_segments) {
-	// Per face, maintain a set of lines that intersect it. 
+// Every segment is walked through the arrangement from the face containing its left endpoint, so the cost is
+// proportional to the size of the conflict lists rather than to the number of faces times the number of segments.
+// The segments are split over numThreads threads, which only read the arrangement and its point location.
+static ConflictList get_conflict_list(Arrangement* arr, vec<Segment_2>* rest_segments, unsigned int numThreads = 1) {
 	int F = arr->number_of_faces();
-	ConflictList conflict_list(F);
 
 	int face_index = 0;
 	for (Face_handle face = arr->faces_begin(); face != arr->faces_end(); face++, face_index++) {
@@ -156,204 +331,668 @@ static ConflictList get_conflict_list(Arrangement* arr, vec<Segment_2>* rest_seg
 			face_index
 		};
 		face->set_data(fd);
+	}
 
-		conflict_list[face_index] = set<int>();
-		
-		// Test intersection with the segments describing the face
-		Halfedge_handle start = *face->outer_ccbs_begin();
-		Halfedge_handle curr = start;
-		do {
-			Segment_2 edge(curr->source()->point(), curr->target()->point());
-
-			// Iterate over all segments
-			for (int segment_index = 0; segment_index < rest_segments->size(); segment_index++) {
-				auto line = (*rest_segments)[segment_index];
-				auto result = CGAL::intersection(line, edge);
+	// Collect the faces per segment, then distribute the segments over the faces in increasing order
+	Trapezoid_pl pl(*arr);
+	vec<int> part_begins(numThreads);
+	vec<vec<int>> part_offsets(numThreads), part_faces(numThreads);
+	parallel_for_parts(rest_segments->size(), numThreads, [&](unsigned int part, int begin, int end) {
+		auto segment_offsets = &part_offsets[part];
+		auto segment_faces = &part_faces[part];
+		part_begins[part] = begin;
+		segment_offsets->push_back(0);
+		for (int segment_index = begin; segment_index < end; segment_index++) {
+			auto faces_begin = segment_faces->size();
+			ConflictCollector collector = { segment_faces };
+			CGAL::zone(*arr, (*rest_segments)[segment_index], collector, pl);
+
+			// faces around a vertex or edge are reported more than once
+			sort(segment_faces->begin() + faces_begin, segment_faces->end());
+			segment_faces->erase(unique(segment_faces->begin() + faces_begin, segment_faces->end()), segment_faces->end());
+			segment_offsets->push_back(segment_faces->size());
+		}
+	});
 
-				if (result && get_if<Point_2>(&*result)) {
-					// We dont actually care about where the intersection is, 
-					// just that it happened
-					conflict_list[face_index].insert(segment_index);
-				}
-			}		
-			curr = curr->next();
-		} while (curr != start);
+	ConflictList conflict_list = { vec<int>(F + 1, 0), {} };
+	for (auto& segment_faces : part_faces) {
+		for (int face : segment_faces) conflict_list.offsets[face + 1]++;
+	}
+	for (int f = 0; f < F; f++) conflict_list.offsets[f + 1] += conflict_list.offsets[f];
+	conflict_list.lines.resize(conflict_list.offsets[F]);
+
+	vec<int> next(conflict_list.offsets.begin(), conflict_list.offsets.end() - 1);
+	for (unsigned int part = 0; part < numThreads; part++) {
+		for (int j = 0; j + 1 < part_offsets[part].size(); j++) {
+			for (int i = part_offsets[part][j]; i < part_offsets[part][j + 1]; i++) {
+				conflict_list.lines[next[part_faces[part][i]]++] = part_begins[part] + j;
+			}
+		}
 	}
-
 	return conflict_list;
 }
 
+static int get_max_conflicts(ConflictList* cl) {
+	int max_conflicts = 0;
+	for (int f = 0; f + 1 < cl->offsets.size(); f++) {
+		max_conflicts = max(max_conflicts, cl->offsets[f + 1] - cl->offsets[f]);
+	}
+	return max_conflicts;
+}
+
 static bool is_valid_r_cutting(ConflictList* cl, int N, int r, double smudge_factor = 1) {
 	int max = (int)round((double)N / (double)r * smudge_factor);
 	// Check if any face has more than r intersecting lines
-	for (auto s = cl->begin(); s < cl->end(); s++) {
-		if (s->size() > max) return false;
-	}
-	return true;
+	return get_max_conflicts(cl) <= max;
 }
 
-static void annotate_arrangement(Arrangement* arr, ConflictList* cl, vec<Segment_2>* lines, Point_2 lower, vec<int>* colors) {
-	// for each face, annotate with the color that passes through it most
-	// along with the frequency of colors below it that also pass through the face
+// Gives both pieces of a split face the index of the face they were split from
+struct SplitFaceObserver : public CGAL::Arr_observer<Arrangement> {
+	SplitFaceObserver(Arrangement& arr) : CGAL::Arr_observer<Arrangement>(arr) {}
+
+	virtual void after_split_face(Face_handle face, Face_handle new_face, bool is_hole) {
+		new_face->set_data(face->data());
+	}
+};
+
+// Splits every face crossed by more than max_conflicts lines by a random sample of its conflict list, clipped to the
+// face, rather than building a new arrangement. Only the pieces of the split faces get new conflict lists, from the
+// lines of the face they were split from. The pieces stay convex, so they are not triangulated.
+// The clipped samples are inexact constructions, and may end just beyond their face. Should such an end split a
+// neighbouring face, that face counts as split too.
+static void refine_cutting(Cutting* cutting, vec<Segment_2>* segments, int max_conflicts) {
+	Arrangement* arr = &cutting->arr;
+	ConflictList* cl = &cutting->cl;
+	int F = cl->offsets.size() - 1;
+
+	vec<char> overloaded(F, false);
+	vec<vec<Point_2>> polygons(F);
 	for (Face_handle face = arr->faces_begin(); face != arr->faces_end(); face++) {
 		if (face->is_unbounded()) continue;
 
-		int face_index = face->data().index;
-		vec<set<int>> lines_under_vertices = vec<set<int>>(3);
-		for (int i = 0; i < 3; i++) lines_under_vertices[i] = set<int>();
-		
-		// Find the lines that lie fully below each face
-		int edge_index = 0;
-		Halfedge_handle curr = *face->outer_ccbs_begin();
-		for (int edge_index = 0; edge_index < 3; edge_index++) {
-			// Lines that are below the target vertex of the edge
-			Point_2 target = curr->target()->point();
-			Segment_2 ray_down(target, Point_2(target.x(), lower.y()));
-			for (int line_index = 0; line_index < lines->size(); line_index++) {
-				auto line = (*lines)[line_index];
-				auto res = CGAL::intersection(ray_down, line);
-				if (res && get_if<Point_2>(&*res)) {
-					// If ray from vertex hits line, add it to that vertex's conflict list
-					lines_under_vertices[edge_index].insert(line_index);
-				}
-			}
+		int f = face->data().index;
+		polygons[f] = get_face_polygon(face);
+		overloaded[f] = cl->offsets[f + 1] - cl->offsets[f] > max_conflicts;
+	}
 
-			// Go to next halfedge
-			curr = curr->next();
+	// sample enough lines per face for a cutting of its own lines into parts of half the allowed size
+	vec<Segment_2> sample_segments = {};
+	for (int f = 0; f < F; f++) {
+		if (!overloaded[f]) continue;
+
+		vec<int> face_lines(cl->lines.begin() + cl->offsets[f], cl->lines.begin() + cl->offsets[f + 1]);
+		int r_face = max(2, (int)ceil(2.0 * face_lines.size() / max(1, max_conflicts)));
+		int sample_size = min((int)face_lines.size(), (int)ceil(r_face * log(r_face) / log(2)));
+		for (int line_index : random_split(&face_lines, sample_size).first) {
+			Segment_2 clipped;
+			if (clip_to_polygon((*segments)[line_index], &polygons[f], &clipped)) sample_segments.push_back(clipped);
 		}
+	}
+	{
+		SplitFaceObserver observer(*arr);
+		CGAL::insert(*arr, sample_segments.begin(), sample_segments.end());
+	}
 
-		// Once we have the intersection list for each of the vertex rays, 
-		// take the intersection in order to get the lines that are fully beneath it.
-		set<int> intersect_01;
-		set<int> lines_under_face;
-		set_intersection(
-			lines_under_vertices[0].begin(), lines_under_vertices[0].end(),
-			lines_under_vertices[1].begin(), lines_under_vertices[1].end(),
-			inserter(intersect_01, intersect_01.begin())
-		);
-		set_intersection(
-			intersect_01.begin(), intersect_01.end(),
-			lines_under_vertices[2].begin(), lines_under_vertices[2].end(),
-			inserter(lines_under_face, lines_under_face.begin())
-		);
-		
-		// Now, determine color frequency for intersecting lines / lines below
-		map<int, int> under_color_counts, intersecting_color_counts;
-		for (int line_index : (*cl)[face_index] ) {
-			int color = (*colors)[line_index];
-			if (intersecting_color_counts.count(color)) intersecting_color_counts[color]++;
-			else intersecting_color_counts[color] = 1;
-		}
-		// Only add color below if it is also present in the intersection list,
-		// otherwise we dont need it
-		for (int line_index : lines_under_face) {
-			int color = (*colors)[line_index];
-			if (!intersecting_color_counts[color]) continue;
-			if (under_color_counts.count(color)) under_color_counts[color]++;
-			else under_color_counts[color] = 1;
-		}
-		
-		// Determine the mode color of intersecting lines
-		pair<int, int> mode = *max_element(
-			begin(intersecting_color_counts),
-			end(intersecting_color_counts),
-			[](const pair<int, int> a, const pair<int, int> b) { return a.second < b.second; }
-		);
-
-		// Annotate face 
+	// a face was split if any of its pieces is, which holds for all overloaded faces that got a sample
+	vec<int> pieces(F, 0);
+	for (Face_handle face = arr->faces_begin(); face != arr->faces_end(); face++) {
+		if (!face->is_unbounded()) pieces[face->data().index]++;
+	}
+	vec<char> was_split(F, false);
+	for (int f = 0; f < F; f++) was_split[f] = overloaded[f] || pieces[f] > 1;
+
+	// number the faces again, faces that were not split keep their conflict lists
+	int new_F = arr->number_of_faces();
+	vec<int> kept(new_F, -1);
+	vec<char> split(new_F, false);
+	int face_index = 0;
+	for (Face_handle face = arr->faces_begin(); face != arr->faces_end(); face++, face_index++) {
+		if (face->is_unbounded()) continue;
+
+		int f = face->data().index;
+		if (was_split[f]) split[face_index] = true;
+		else kept[face_index] = f;
 		FaceData fd = {
-			face_index,
-			mode,
-			under_color_counts,
+			face_index
 		};
 		face->set_data(fd);
-		if (face_index == cl->size() - 1) {
-			break; // premature end as there are no more faces to be checked
+	}
+
+	// walk the lines of every split face through its pieces
+	Trapezoid_pl pl(*arr);
+	vec<pair<int, int>> entries = {}; // face, line
+	vec<int> faces = {};
+	for (int f = 0; f < F; f++) {
+		if (!was_split[f]) continue;
+
+		for (int i = cl->offsets[f]; i < cl->offsets[f + 1]; i++) {
+			Segment_2 clipped;
+			if (!clip_to_polygon((*segments)[cl->lines[i]], &polygons[f], &clipped)) continue;
+
+			faces.clear();
+			ConflictCollector collector = { &faces };
+			CGAL::zone(*arr, clipped, collector, pl);
+			for (int face : faces) {
+				if (split[face]) entries.push_back({ face, cl->lines[i] });
+			}
 		}
 	}
+	sort(entries.begin(), entries.end());
+	entries.erase(unique(entries.begin(), entries.end()), entries.end());
+
+	ConflictList refined = { vec<int>(new_F + 1, 0), {} };
+	for (int g = 0; g < new_F; g++) {
+		if (kept[g] >= 0) refined.offsets[g + 1] = cl->offsets[kept[g] + 1] - cl->offsets[kept[g]];
+	}
+	for (auto& entry : entries) refined.offsets[entry.first + 1]++;
+	for (int g = 0; g < new_F; g++) refined.offsets[g + 1] += refined.offsets[g];
+	refined.lines.resize(refined.offsets[new_F]);
+
+	vec<int> next(refined.offsets.begin(), refined.offsets.end() - 1);
+	for (int g = 0; g < new_F; g++) {
+		if (kept[g] < 0) continue;
+		copy(cl->lines.begin() + cl->offsets[kept[g]], cl->lines.begin() + cl->offsets[kept[g] + 1], refined.lines.begin() + next[g]);
+	}
+	for (auto& entry : entries) refined.lines[next[entry.first]++] = entry.second;
+	cutting->cl = refined;
 }
 
-// Returns the mode color for a certain query point
-static pair<int, int> query_arrangement(ModeData* md, Trapezoid_pl* tpl, vec<int>* colors, Point_2 q) {
-	// first, find the face that the query point is in.
-	auto result = tpl->locate(q);
+// Whether a segment lies below p, for a point p that the segment does not pass through
+static bool is_below(const Segment_2& segment, Point_2 p) {
+	return CGAL::orientation(segment.min(), segment.max(), p) == CGAL::LEFT_TURN;
+}
 
-	if (const Face_const_handle* face_ptr = get_if<Face_const_handle>(&result)) {
-		Face_const_handle face = *face_ptr;
-		// then, for this face, find which of the lines in the conflict list are below the query point
-		
-		map<int, int> candidate_modes(face->data().under_frequencies);
-		int face_index = face->data().index;
-		for (auto line_index : (md->cl)[face_index]) {
-			// add count if the line is below q
-			Segment_2 ray_down(q, Point_2(q.x(), md->lower.y()));
-			auto result = CGAL::intersection(ray_down, (md->segments)[line_index]);
-			if (result && get_if<Point_2>(&*result)) {
-				// Add 1 to the line
-				int color = (*colors)[line_index];
-				if (candidate_modes.count(color)) candidate_modes[color]++;
-				else candidate_modes[color] = 1;
+// Returns a point in the interior of every bounded face, indexed by face index. Faces are convex, so the average
+// of the vertices of a face lies inside it.
+static vec<Point_2> get_face_centers(Arrangement* arr, int F) {
+	vec<Point_2> centers(F);
+	for (Face_handle face = arr->faces_begin(); face != arr->faces_end(); face++) {
+		if (face->is_unbounded()) continue;
+
+		double x = 0, y = 0;
+		int count = 0;
+		Halfedge_handle start = *face->outer_ccbs_begin();
+		Halfedge_handle curr = start;
+		do {
+			x += curr->target()->point().x();
+			y += curr->target()->point().y();
+			count++;
+			curr = curr->next();
+		} while (curr != start);
+		centers[face->data().index] = Point_2(x / count, y / count);
+	}
+	return centers;
+}
+
+// Returns the distinct colors of the conflict list of every face, with the below counts and modes left empty.
+// The faces are split over numThreads threads.
+static FaceFrequencies get_face_frequencies(ConflictList* cl, vec<int>* colors, unsigned int numThreads = 1) {
+	int F = cl->offsets.size() - 1;
+	FaceFrequencies ff = { vec<int>(F + 1, 0), {}, {}, vec<int>(cl->lines.size()), vec<pair<int, int>>(F, pair<int, int>(-1, 0)) };
+
+	vec<vec<int>> part_colors(numThreads);
+	parallel_for_parts(F, numThreads, [&](unsigned int part, int begin, int end) {
+		auto face_colors = &part_colors[part];
+		for (int f = begin; f < end; f++) {
+			int colors_begin = face_colors->size();
+			for (int i = cl->offsets[f]; i < cl->offsets[f + 1]; i++) face_colors->push_back((*colors)[cl->lines[i]]);
+			sort(face_colors->begin() + colors_begin, face_colors->end());
+			face_colors->erase(unique(face_colors->begin() + colors_begin, face_colors->end()), face_colors->end());
+			ff.offsets[f + 1] = face_colors->size() - colors_begin;
+
+			for (int i = cl->offsets[f]; i < cl->offsets[f + 1]; i++) {
+				auto color = lower_bound(face_colors->begin() + colors_begin, face_colors->end(), (*colors)[cl->lines[i]]);
+				ff.slots[i] = color - face_colors->begin() - colors_begin;
 			}
 		}
+	});
+	for (int f = 0; f < F; f++) ff.offsets[f + 1] += ff.offsets[f];
+	for (auto& face_colors : part_colors) {
+		ff.colors.insert(ff.colors.end(), face_colors.begin(), face_colors.end());
+	}
+	ff.under_counts.assign(ff.colors.size(), 0);
+	return ff;
+}
+
+// Returns the bounded neighbours of every bounded face, and sets root to one of the bounded faces, or -1 if none
+static vec<vec<int>> get_face_neighbours(Arrangement* arr, int F, int* root) {
+	vec<vec<int>> neighbours(F);
+	*root = -1;
+	for (Face_handle face = arr->faces_begin(); face != arr->faces_end(); face++) {
+		if (face->is_unbounded()) continue;
+
+		int face_index = face->data().index;
+		if (*root < 0) *root = face_index;
+
+		Halfedge_handle start = *face->outer_ccbs_begin();
+		Halfedge_handle curr = start;
+		do {
+			Face_handle other = curr->twin()->face();
+			if (!other->is_unbounded()) neighbours[face_index].push_back(other->data().index);
+			curr = curr->next();
+		} while (curr != start);
+	}
+	return neighbours;
+}
+
+// The lines fully below the current face of a traversal, and the number of them per color. Colors with the same
+// number are kept in a doubly linked list per number, so the mode of the lines below is known at any time.
+struct BelowState {
+	vec<Segment_2>* lines;
+	vec<int>* colors;
+	vec<bool> below;
+	vec<int> counts;
+	vec<int> heads, next, prev;
+	int max_count;
+
+	BelowState(vec<Segment_2>* lines, vec<int>* colors) : lines(lines), colors(colors), below(lines->size(), false), max_count(0) {
+		int num_colors = colors->empty() ? 0 : *max_element(colors->begin(), colors->end()) + 1;
+		counts.assign(num_colors, 0);
+		heads.assign(lines->size() + 1, -1);
+		next.assign(num_colors, -1);
+		prev.assign(num_colors, -1);
+		for (int color = 0; color < num_colors; color++) link(color);
+	}
+
+	void link(int color) {
+		int head = heads[counts[color]];
+		next[color] = head;
+		prev[color] = -1;
+		if (head >= 0) prev[head] = color;
+		heads[counts[color]] = color;
+	}
+
+	void unlink(int color) {
+		if (prev[color] >= 0) next[prev[color]] = next[color];
+		else heads[counts[color]] = next[color];
+		if (next[color] >= 0) prev[next[color]] = prev[color];
+	}
+
+	void set(int line_index, bool is_line_below) {
+		if (below[line_index] == is_line_below) return;
+		below[line_index] = is_line_below;
+
+		int color = (*colors)[line_index];
+		unlink(color);
+		counts[color] += is_line_below ? 1 : -1;
+		link(color);
+		if (counts[color] > max_count) max_count = counts[color];
+		else if (heads[max_count] < 0) max_count--;
+	}
+
+	// Sets the status of a line that does not cross the face containing p
+	void classify(int line_index, Point_2 p) {
+		set(line_index, is_below((*lines)[line_index], p));
+	}
+
+	// Returns a color with the most lines fully below the current face, or (-1, 0) if there are none
+	pair<int, int> mode() {
+		if (max_count == 0) return pair<int, int>(-1, 0);
+		return pair<int, int>(heads[max_count], max_count);
+	}
+};
+
+// Visits every face reachable from root once, depth first over the adjacency of the faces, and calls visit(face)
+// with the state at the lines fully below that face. A line that intersects neither of two adjacent faces lies on
+// the same side of both, so stepping to a neighbour only changes the status of the lines in the conflict lists of
+// the two faces. The status of cell_lines, which are all lines that may cross the faces, is set at the root first,
+// and the state is left at the root afterwards.
+template<class Visit>
+static void traverse_faces(ConflictList* cl, vec<vec<int>>* neighbours, vec<Point_2>* centers, int root, vec<int>* cell_lines, BelowState* state, Visit visit) {
+	auto step = [&](int from, int to) {
+		for (int i = cl->offsets[from]; i < cl->offsets[from + 1]; i++) state->classify(cl->lines[i], (*centers)[to]);
+		for (int i = cl->offsets[to]; i < cl->offsets[to + 1]; i++) state->set(cl->lines[i], false);
+	};
+
+	for (int line_index : *cell_lines) state->classify(line_index, (*centers)[root]);
+	for (int i = cl->offsets[root]; i < cl->offsets[root + 1]; i++) state->set(cl->lines[i], false);
+	visit(root);
+
+	// stepping back to the parent face after all neighbours of a face have been visited
+	vec<bool> visited(cl->offsets.size() - 1, false);
+	visited[root] = true;
+	vec<pair<int, int>> path = { { root, 0 } }; // face index, next neighbour to visit
+	while (!path.empty()) {
+		auto& top = path.back();
+		int face_index = top.first;
+		if (top.second == (*neighbours)[face_index].size()) {
+			path.pop_back();
+			if (!path.empty()) step(face_index, path.back().first);
+			continue;
+		}
+
+		int next = (*neighbours)[face_index][top.second++];
+		if (visited[next]) continue;
+		visited[next] = true;
+		step(face_index, next);
+		visit(next);
+		path.push_back({ next, 0 });
+	}
+}
 
-		if (candidate_modes.size() == 0) {
-			return pair<int, int>(-1, 0);
+// Returns the colors and below counts of the conflict list of every face, along with the mode of the lines fully
+// below every face. The colors of the faces are collected on numThreads threads, the below counts are propagated
+// between neighbouring faces on a single thread.
+static FaceFrequencies annotate_arrangement(Arrangement* arr, ConflictList* cl, vec<Segment_2>* lines, vec<int>* colors, unsigned int numThreads = 1) {
+	int F = cl->offsets.size() - 1;
+	auto ff = get_face_frequencies(cl, colors, numThreads);
+
+	int root;
+	auto neighbours = get_face_neighbours(arr, F, &root);
+	if (root < 0) return ff;
+	auto centers = get_face_centers(arr, F);
+
+	BelowState state(lines, colors);
+	vec<int> all_lines(lines->size());
+	iota(all_lines.begin(), all_lines.end(), 0);
+	traverse_faces(cl, &neighbours, &centers, root, &all_lines, &state, [&](int face_index) {
+		for (int i = ff.offsets[face_index]; i < ff.offsets[face_index + 1]; i++) {
+			ff.under_counts[i] = state.counts[ff.colors[i]];
 		}
+		ff.below_modes[face_index] = state.mode();
+	});
+	return ff;
+}
 
-		// Get the maximum candidate mode and returnpair<int, int> mode = *max_element(
-		pair<int, int> mode = *max_element(
-			begin(candidate_modes),
-			end(candidate_modes),
-			[](const pair<int, int> a, const pair<int, int> b) { return a.second < b.second; }
-		);
-		return mode;
+// Packs the endpoints of the segments, in the order of the conflict lists
+static PackedLines pack_conflict_lines(ConflictList* cl, vec<Segment_2>* segments) {
+	int L = cl->lines.size();
+	PackedLines packed = { vec<double>(L), vec<double>(L), vec<double>(L), vec<double>(L) };
+	for (int i = 0; i < L; i++) {
+		const Segment_2& segment = (*segments)[cl->lines[i]];
+		packed.px[i] = segment.min().x();
+		packed.py[i] = segment.min().y();
+		packed.dx[i] = segment.max().x() - segment.min().x();
+		packed.dy[i] = segment.max().y() - segment.min().y();
 	}
-	else {
+	return packed;
+}
+
+// Error bound of the orientation determinant in doubles, relative to the largest differences per axis, as in the
+// static filter of the orientation predicate of the kernel
+static const double ORIENTATION_ERROR = 8.8872057372592798e-16;
+
+// Returns 1 if the segment from (px, py) by (dx, dy) lies below (x, y), 0 if it does not, and -1 if it is too close
+// to tell in floating point, which also covers differences too small or too large for the error bound. This is the
+// sign of the orientation that is_below decides exactly. The result is a double, since loops comparing doubles
+// only vectorize into doubles on SSE2.
+static inline double classify_line(double px, double py, double dx, double dy, double x, double y) {
+	double rx = x - px, ry = y - py;
+	double det = dx * ry - dy * rx;
+	double max_x = max(fabs(dx), fabs(rx)), max_y = max(fabs(dy), fabs(ry));
+	double bound = ORIENTATION_ERROR * max_x * max_y;
+	double result = det > bound ? 1.0 : (det < -bound ? 0.0 : -1.0);
+	result = min(max_x, max_y) < 1e-146 ? -1.0 : result;
+	return max(max_x, max_y) >= 1e153 ? -1.0 : result;
+}
+
+// Classifies the packed segments [begin, end) against q into below, see classify_line. The loop is vectorized.
+static void classify_packed_lines(PackedLines* packed, int begin, int end, Point_2 q, double* below) {
+	const double* px = packed->px.data();
+	const double* py = packed->py.data();
+	const double* dx = packed->dx.data();
+	const double* dy = packed->dy.data();
+	const double x = q.x(), y = q.y();
+	for (int i = begin; i < end; i++) {
+		below[i - begin] = classify_line(px[i], py[i], dx[i], dy[i], x, y);
+	}
+}
+
+// Whether line i of the conflict lists lies below q, decided exactly on its segment, such that it agrees with the
+// below counts of the faces
+static bool is_conflict_line_below(ModeData* md, int i, Point_2 q) {
+	return is_below(md->segments[md->cl.lines[i]], q);
+}
+
+// Returns the index of a bounded face whose closure contains the located point, or -1 if there is none
+static int get_located_face(Point_location_result::Type* result) {
+	if (const Face_const_handle* face = get_if<Face_const_handle>(result)) {
+		return (*face)->is_unbounded() ? -1 : (*face)->data().index;
+	}
+	if (const Arrangement::Halfedge_const_handle* halfedge = get_if<Arrangement::Halfedge_const_handle>(result)) {
+		Face_const_handle face = (*halfedge)->face();
+		if (face->is_unbounded()) face = (*halfedge)->twin()->face();
+		return face->is_unbounded() ? -1 : face->data().index;
+	}
+	if (const Arrangement::Vertex_const_handle* vertex = get_if<Arrangement::Vertex_const_handle>(result)) {
+		if ((*vertex)->is_isolated()) {
+			Face_const_handle face = (*vertex)->face();
+			return face->is_unbounded() ? -1 : face->data().index;
+		}
+		auto start = (*vertex)->incident_halfedges();
+		auto curr = start;
+		do {
+			if (!curr->face()->is_unbounded()) return curr->face()->data().index;
+		} while (++curr != start);
+	}
+	return -1;
+}
+
+// Returns the mode color of the lines below q, given the index of the face containing q
+static pair<int, int> query_face(ModeData* md, int face_index, Point_2 q) {
+	FaceFrequencies* ff = &md->frequencies;
+	int colors_begin = ff->offsets[face_index], colors_end = ff->offsets[face_index + 1];
+
+	// start from the lines fully below the face, reusing the buffers of earlier queries on this thread
+	thread_local vec<int> candidate_counts;
+	thread_local vec<double> below;
+	candidate_counts.assign(ff->under_counts.begin() + colors_begin, ff->under_counts.begin() + colors_end);
+
+	// then, for this face, find which of the lines in the conflict list are below the query point
+	int begin = md->cl.offsets[face_index], end = md->cl.offsets[face_index + 1];
+	if (below.size() < end - begin) below.resize(end - begin);
+	classify_packed_lines(&md->packed, begin, end, q, below.data());
+	for (int i = begin; i < end; i++) {
+		// add count if the line is below q
+		double line_below = below[i - begin];
+		if (line_below < 0) line_below = is_conflict_line_below(md, i, q);
+		candidate_counts[ff->slots[i]] += (int)line_below;
+	}
+
+	// colors that do not cross the face only have lines fully below it, ties go to any of the colors
+	pair<int, int> mode = ff->below_modes[face_index];
+	for (int slot = 0; slot < candidate_counts.size(); slot++) {
+		if (candidate_counts[slot] > mode.second) mode = { ff->colors[colors_begin + slot], candidate_counts[slot] };
+	}
+	return mode;
+}
+
+// Returns the mode color for a certain query point
+static pair<int, int> query_arrangement(ModeData* md, Trapezoid_pl* tpl, vec<int>* colors, Point_2 q) {
+	// first, find the face that the query point is in, points on edges and vertices take one of the faces around them
+	auto result = tpl->locate(q);
+	int face_index = get_located_face(&result);
+	if (face_index < 0) {
 		cout << "Could not locate point " << q << " due to point location not returning a face.";
 		return pair<int, int>(-1, 0);
 	}
+	return query_face(md, face_index, q);
 }
 
-static ModeData preprocess_mode(vec<Point_2>* points, vec<int>* colors, int r) {
-	// convert all points to duals
-	auto lines = get_dual_lines(points);
-	// bounding box for arrangement
-	Point_2 lower(-1, -1), upper(1, 1);
+// Answers all queries at once, and returns the modes in the order of the queries. The faces of all queries are
+// found in a single sweep over the arrangement, and the queries are grouped by face. Each line of the conflict list
+// of a face is then classified against all queries of its group in one vectorized pass over their coordinates,
+// with the counts per color laid out such that every line adds to a contiguous row.
+static vec<pair<int, int>> batch_query_arrangement(ModeData* md, vec<int>* colors, vec<Point_2>* queries) {
+	int Q = queries->size();
+	vec<pair<int, int>> modes(Q, pair<int, int>(-1, 0));
+
+	vec<Query_result> located = {};
+	CGAL::locate(md->arr, queries->begin(), queries->end(), back_inserter(located));
+
+	// the sweep reports the points in its own order, match them back to the queries
+	vec<pair<Point_2, int>> sorted_queries(Q);
+	for (int j = 0; j < Q; j++) sorted_queries[j] = { (*queries)[j], j };
+	sort(sorted_queries.begin(), sorted_queries.end(), [](const pair<Point_2, int>& a, const pair<Point_2, int>& b) {
+		return a.first < b.first;
+	});
+
+	vec<pair<int, int>> query_faces = {}; // face, query
+	for (auto& result : located) {
+		int face_index = get_located_face(&result.second);
+		if (face_index < 0) continue;
+
+		auto match = lower_bound(sorted_queries.begin(), sorted_queries.end(), result.first, [](const pair<Point_2, int>& a, const Point_2& p) {
+			return a.first < p;
+		});
+		for (; match != sorted_queries.end() && match->first == result.first; match++) {
+			query_faces.push_back({ face_index, match->second });
+		}
+	}
+	sort(query_faces.begin(), query_faces.end());
+	query_faces.erase(unique(query_faces.begin(), query_faces.end()), query_faces.end());
+
+	FaceFrequencies* ff = &md->frequencies;
+	PackedLines* packed = &md->packed;
+	vec<double> xs, ys, below, counts;
+	for (int group_begin = 0; group_begin < query_faces.size();) {
+		int face_index = query_faces[group_begin].first;
+		int group_end = group_begin;
+		while (group_end < query_faces.size() && query_faces[group_end].first == face_index) group_end++;
+		int G = group_end - group_begin;
+
+		xs.resize(G);
+		ys.resize(G);
+		below.resize(G);
+		for (int j = 0; j < G; j++) {
+			xs[j] = (*queries)[query_faces[group_begin + j].second].x();
+			ys[j] = (*queries)[query_faces[group_begin + j].second].y();
+		}
 
-	// Variables are set in loop
-	Arrangement arr;
-	ConflictList cl;
-	vec<Segment_2> segments;
+		// counts[slot * G + j] is the number of lines of that color below query j, starting from those below the face
+		int colors_begin = ff->offsets[face_index], colors_end = ff->offsets[face_index + 1];
+		counts.resize((colors_end - colors_begin) * G);
+		for (int slot = 0; slot < colors_end - colors_begin; slot++) {
+			fill(counts.begin() + slot * G, counts.begin() + (slot + 1) * G, (double)ff->under_counts[colors_begin + slot]);
+		}
+
+		for (int i = md->cl.offsets[face_index]; i < md->cl.offsets[face_index + 1]; i++) {
+			double px = packed->px[i], py = packed->py[i], dx = packed->dx[i], dy = packed->dy[i];
+			double* slot_counts = counts.data() + ff->slots[i] * G;
+			double uncertain = 0;
+			for (int j = 0; j < G; j++) {
+				double line_below = classify_line(px, py, dx, dy, xs[j], ys[j]);
+				below[j] = line_below;
+				slot_counts[j] += line_below > 0 ? 1.0 : 0.0;
+				uncertain = line_below < 0 ? 1.0 : uncertain;
+			}
 
-	// TODO: replace with while true as we always have a fixed chance of generating a valid cutting
-	int MAX_RETRY = 10, retry = 0;
-	while (retry < MAX_RETRY) {
-		// split dual lines into two parts: ones used for arrangement, and rest.
-		auto split_lines = random_split(&lines, r * log(r) / log(2));
-		auto arrangement_segments = get_segments(&split_lines.first, lower, upper, true);
-		segments = get_segments(&lines, lower, upper, false);
+			// only near-ties take the exact predicate
+			if (uncertain == 0) continue;
+			for (int j = 0; j < G; j++) {
+				if (below[j] < 0 && is_conflict_line_below(md, i, Point_2(xs[j], ys[j]))) slot_counts[j]++;
+			}
+		}
 
-		// create arrangement using only the randomly selected dual lines
-		arr = create_arrangement(&arrangement_segments);
-		triangulate_arrangement(&arr);
-		cl = get_conflict_list(&arr, &segments);
+		// start from the colors that do not cross the face, ties go to any of the colors
+		for (int j = 0; j < G; j++) {
+			pair<int, int> mode = ff->below_modes[face_index];
+			for (int slot = 0; slot < colors_end - colors_begin; slot++) {
+				int count = (int)counts[slot * G + j];
+				if (count > mode.second) mode = { ff->colors[colors_begin + slot], count };
+			}
+			modes[query_faces[group_begin + j].second] = mode;
+		}
+		group_begin = group_end;
+	}
+	return modes;
+}
 
-		// if it is a valid conflict list, we have our final arrangement
-		if (is_valid_r_cutting(&cl, points->size(), r), 1.2) break;
+// Builds a candidate cutting from a random sample of the lines, into an empty cutting
+static void build_cutting(vec<Line_2>* lines, vec<Segment_2>* segments, int r, Point_2 lower, Point_2 upper, Cutting* cutting, unsigned int numThreads) {
+	// split dual lines into two parts: ones used for arrangement, and rest.
+	auto split_lines = random_split(lines, r * log(r) / log(2));
+	auto arrangement_segments = get_segments(&split_lines.first, lower, upper, true);
 
-		retry++;
+	// create arrangement using only the randomly selected dual lines
+	CGAL::insert(cutting->arr, arrangement_segments.begin(), arrangement_segments.end());
+	triangulate_arrangement(&cutting->arr);
+	cutting->cl = get_conflict_list(&cutting->arr, segments, numThreads);
+}
+
+// Preprocesses on numThreads threads, or one per hardware thread if 0. The cutting is verified to have conflict
+// lists of at most 1.2 N / r lines. Should refining not get there, a fresh round of samples is drawn, and if the
+// last round fails as well, the structure is returned with valid set to false. Queries on it are still exact, but
+// may scan longer conflict lists.
+static ModeData preprocess_dual_lines(vec<Line_2>* lines, vec<int>* colors, int r, unsigned int numThreads = 0) {
+	// bounding box for arrangement
+	auto box = get_dual_box();
+	Point_2 lower = box.first, upper = box.second;
+	auto segments = get_segments(lines, lower, upper, false);
+	if (numThreads == 0) numThreads = max(1u, thread::hardware_concurrency());
+
+	// Candidates are built in rounds of one per thread, each from its own random sample, and the one with the
+	// smallest largest conflict list is kept. A round with a single candidate uses all threads for its conflict list.
+	int MAX_CANDIDATES = 10, MAX_ROUNDS = 3;
+	int attempts = min((int)numThreads, MAX_CANDIDATES);
+	unsigned int conflict_threads = attempts == 1 ? numThreads : 1;
+	vec<Cutting> candidates;
+	Cutting* cutting = nullptr;
+	bool valid = false;
+	for (int round_index = 0; round_index < MAX_ROUNDS && !valid; round_index++) {
+		candidates = vec<Cutting>(attempts);
+		vec<int> largest(attempts);
+		parallel_for_parts(attempts, attempts, [&](unsigned int part, int begin, int end) {
+			build_cutting(lines, &segments, r, lower, upper, &candidates[part], conflict_threads);
+			largest[part] = get_max_conflicts(&candidates[part].cl);
+		});
+		INSTRUMENT_COUNT(CuttingAttempts, attempts);
+
+		int chosen = min_element(largest.begin(), largest.end()) - largest.begin();
+		cutting = &candidates[chosen];
+
+		// Refine the overloaded faces until it is a valid cutting. Every refinement that does not shrink the largest
+		// conflict list counts against a fixed budget, so this always terminates.
+		int MAX_STALLED_REFINEMENTS = 3, stalled = 0;
+		int largest_conflicts = largest[chosen];
+		valid = is_valid_r_cutting(&cutting->cl, lines->size(), r, 1.2);
+		while (!valid && stalled < MAX_STALLED_REFINEMENTS) {
+			refine_cutting(cutting, &segments, (int)round((double)lines->size() / (double)r * 1.2));
+			INSTRUMENT_COUNT(CuttingRefinements, 1);
+
+			int refined_largest = get_max_conflicts(&cutting->cl);
+			if (refined_largest < largest_conflicts) stalled = 0;
+			else stalled++;
+			largest_conflicts = min(largest_conflicts, refined_largest);
+			valid = is_valid_r_cutting(&cutting->cl, lines->size(), r, 1.2);
+		}
 	}
+	INSTRUMENT_MAX(CuttingMaxConflicts, get_max_conflicts(&cutting->cl));
 
 	// Add query preprocessing data to arrangement
-	annotate_arrangement(&arr, &cl, &segments, lower, colors);
+	auto frequencies = annotate_arrangement(&cutting->arr, &cutting->cl, &segments, colors, numThreads);
+	auto packed = pack_conflict_lines(&cutting->cl, &segments);
 
 	// return the precomputed datastructure
 	ModeData md = {
 		segments,
-		arr,
-		cl,
+		cutting->arr,
+		cutting->cl,
+		frequencies,
+		packed,
+		DualTransform{ 0, 0, 1 },
 		lower,
 		upper,
+		valid,
 	};
 	return md;
-}
\ No newline at end of file
+}
+
+// Builds the mode structure straight from coordinate columns, such as those of a point store. The points are
+// normalized first, query it with the dual point from get_dual_query on md.transform.
+static ModeData preprocess_mode(vec<double>* xs, vec<double>* ys, vec<int>* colors, int r, unsigned int numThreads = 0) {
+	auto transform = get_dual_transform(xs, ys);
+	auto lines = get_dual_lines(xs, ys, &transform);
+	ModeData md = preprocess_dual_lines(&lines, colors, r, numThreads);
+	md.transform = transform;
+	return md;
+}
+
+static ModeData preprocess_mode(vec<Point_2>* points, vec<int>* colors, int r, unsigned int numThreads = 0) {
+	vec<double> xs(points->size()), ys(points->size());
+	for (int i = 0; i < points->size(); i++) {
+		xs[i] = (*points)[i].x();
+		ys[i] = (*points)[i].y();
+	}
+	return preprocess_mode(&xs, &ys, colors, r, numThreads);
+}
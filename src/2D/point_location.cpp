@@ -0,0 +1,161 @@
+#pragma once
+#include <memory>
+#include <array>
+#include <CGAL/Arr_landmarks_point_location.h>
+#include "mode_query.cpp"
+
+using Landmarks_pl = CGAL::Arr_landmarks_point_location<Arrangement>;
+
+// The strategies for finding the face of a mode query. The trapezoidal map has logarithmic queries but a slow
+// randomized construction, landmarks walk from the nearest arrangement vertex found in a kd-tree, and the grid
+// buckets the faces of the cutting by their bounding boxes.
+enum PointLocationKind {
+	TRAPEZOID_RIC,
+	LANDMARKS,
+	GRID,
+};
+
+// Uniform grid over the box of the arrangement. The faces whose bounding box meets cell (column, row) are
+// faces[cell_offsets[c]] up to faces[cell_offsets[c + 1]] with c = row * columns + column, and the corners of
+// face f, counterclockwise, are corners[corner_offsets[f]] up to corners[corner_offsets[f + 1]].
+typedef struct {
+	Point_2 lower;
+	double cell_width;
+	double cell_height;
+	int columns;
+	int rows;
+	vec<int> cell_offsets;
+	vec<int> faces;
+	vec<int> corner_offsets;
+	vec<Point_2> corners;
+} GridLocator;
+
+// Finds the faces of a mode arrangement with one of the strategies, the arrangement has to outlive it
+typedef struct {
+	PointLocationKind kind;
+	unique_ptr<Trapezoid_pl> trapezoid;
+	unique_ptr<Landmarks_pl> landmarks;
+	GridLocator grid;
+} FaceLocator;
+
+// Builds a grid of about one cell per face over the bounded faces of md, which are convex
+static GridLocator build_grid_locator(ModeData* md) {
+	GridLocator grid;
+	int F = md->cl.offsets.size() - 1;
+	grid.lower = md->lower;
+	grid.columns = grid.rows = max(1, (int)ceil(sqrt((double)F)));
+	grid.cell_width = (md->upper.x() - md->lower.x()) / grid.columns;
+	grid.cell_height = (md->upper.y() - md->lower.y()) / grid.rows;
+
+	vec<vec<Point_2>> polygons(F);
+	for (Face_handle face = md->arr.faces_begin(); face != md->arr.faces_end(); face++) {
+		if (!face->is_unbounded()) polygons[face->data().index] = get_face_polygon(face);
+	}
+
+	// the cells covered by the bounding box of every face, as column and row ranges
+	vec<array<int, 4>> ranges(F);
+	grid.corner_offsets.assign(F + 1, 0);
+	grid.cell_offsets.assign(grid.columns * grid.rows + 1, 0);
+	for (int f = 0; f < F; f++) {
+		double min_x = DBL_MAX, min_y = DBL_MAX, max_x = -DBL_MAX, max_y = -DBL_MAX;
+		for (auto& p : polygons[f]) {
+			min_x = min(min_x, p.x());
+			min_y = min(min_y, p.y());
+			max_x = max(max_x, p.x());
+			max_y = max(max_y, p.y());
+		}
+		ranges[f] = {
+			max(0, (int)floor((min_x - grid.lower.x()) / grid.cell_width)),
+			min(grid.columns - 1, (int)floor((max_x - grid.lower.x()) / grid.cell_width)),
+			max(0, (int)floor((min_y - grid.lower.y()) / grid.cell_height)),
+			min(grid.rows - 1, (int)floor((max_y - grid.lower.y()) / grid.cell_height)),
+		};
+		for (int row = ranges[f][2]; row <= ranges[f][3]; row++) {
+			for (int column = ranges[f][0]; column <= ranges[f][1]; column++) {
+				grid.cell_offsets[row * grid.columns + column + 1]++;
+			}
+		}
+		grid.corner_offsets[f + 1] = grid.corner_offsets[f] + polygons[f].size();
+		grid.corners.insert(grid.corners.end(), polygons[f].begin(), polygons[f].end());
+	}
+	partial_sum(grid.cell_offsets.begin(), grid.cell_offsets.end(), grid.cell_offsets.begin());
+
+	grid.faces.resize(grid.cell_offsets.back());
+	vec<int> fill_positions(grid.cell_offsets.begin(), grid.cell_offsets.end() - 1);
+	for (int f = 0; f < F; f++) {
+		for (int row = ranges[f][2]; row <= ranges[f][3]; row++) {
+			for (int column = ranges[f][0]; column <= ranges[f][1]; column++) {
+				grid.faces[fill_positions[row * grid.columns + column]++] = f;
+			}
+		}
+	}
+	return grid;
+}
+
+// Returns the index of a face containing q, or -1 if q lies outside the box of the grid
+static int locate_grid(GridLocator* grid, Point_2 q) {
+	int column = (int)floor((q.x() - grid->lower.x()) / grid->cell_width);
+	int row = (int)floor((q.y() - grid->lower.y()) / grid->cell_height);
+	if (column < 0 || row < 0 || column > grid->columns || row > grid->rows) return -1;
+
+	// the upper and right sides of the box belong to the last cells
+	column = min(column, grid->columns - 1);
+	row = min(row, grid->rows - 1);
+	int cell = row * grid->columns + column;
+	for (int i = grid->cell_offsets[cell]; i < grid->cell_offsets[cell + 1]; i++) {
+		int f = grid->faces[i];
+		int begin = grid->corner_offsets[f], end = grid->corner_offsets[f + 1];
+		bool inside = true;
+		for (int j = begin; j < end && inside; j++) {
+			const Point_2& corner = grid->corners[j + 1 < end ? j + 1 : begin];
+			inside = CGAL::orientation(grid->corners[j], corner, q) != CGAL::RIGHT_TURN;
+		}
+		if (inside) return f;
+	}
+	return -1;
+}
+
+// Builds the point location of the given kind over the faces of md
+static FaceLocator build_face_locator(ModeData* md, PointLocationKind kind) {
+	FaceLocator locator;
+	locator.kind = kind;
+	switch (kind) {
+	case TRAPEZOID_RIC:
+		locator.trapezoid.reset(new Trapezoid_pl(md->arr));
+		break;
+	case LANDMARKS:
+		locator.landmarks.reset(new Landmarks_pl(md->arr));
+		break;
+	case GRID:
+		locator.grid = build_grid_locator(md);
+		break;
+	}
+	return locator;
+}
+
+// Returns the index of a bounded face whose closure contains q, or -1 if there is none
+static int locate_face(FaceLocator* locator, Point_2 q) {
+	switch (locator->kind) {
+	case TRAPEZOID_RIC: {
+		auto result = locator->trapezoid->locate(q);
+		return get_located_face(&result);
+	}
+	case LANDMARKS: {
+		auto result = locator->landmarks->locate(q);
+		return get_located_face(&result);
+	}
+	case GRID:
+		return locate_grid(&locator->grid, q);
+	}
+	return -1;
+}
+
+// Returns the mode color for a certain query point, see query_arrangement
+static pair<int, int> query_arrangement(ModeData* md, FaceLocator* locator, vec<int>* colors, Point_2 q) {
+	int face_index = locate_face(locator, q);
+	if (face_index < 0) {
+		cout << "Could not locate point " << q << " due to point location not returning a face.";
+		return pair<int, int>(-1, 0);
+	}
+	return query_face(md, face_index, q);
+}
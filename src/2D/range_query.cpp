@@ -1,29 +1,150 @@
 #pragma once
 #include <vector>
+#include <map>
+#include <numeric>
 #include <algorithm>
+#include <cmath>
 #include <chrono> 
 #include "rangetree.h"
+#include "instrumentation.h"
 #include <CGAL/Cartesian_d.h>
 #include <CGAL/Kernel_d/Point_d.h>
 
 namespace N2D {
 	typedef unsigned int uint;
 	typedef int Color;
-	typedef RangeTree::RangeTree<Color>* Tree;
+	typedef int Id; // index into the list of locations
+	typedef RangeTree::RangeTree<Id>* Tree;
 	typedef std::pair<NumTy, int> pair_ni;
-
-	static RangeTree::RangeTree<Color> generate_tree(std::vector<Point_d>* locations, std::vector<Color>* colors) {
+	// All ids at a location that holds more than one point. The range tree merges these into a single point.
+	typedef std::map<std::vector<NumTy>, std::vector<Id>> DuplicateIds;
+	// Sorted coordinates of every dimension, with sentinels at both ends
+	typedef std::vector<std::vector<NumTy>*> SortedDims;
+
+	enum class Metric { LInfinity, Euclidean };
+
+	// The k nearest points to a query, along with the mode of their colors
+	typedef struct {
+		NumTy radius; // distance to the k-th nearest point in the queried metric, or max() if there are fewer than k points
+		std::vector<Id> neighbours; // ordered by distance, then by id
+		Color mode; // the smallest color among those with the highest frequency
+		int frequency;
+	} NearestResult;
+
+	// Stores the id of each location as its value, colors are looked up by id
+	static RangeTree::RangeTree<Id> generate_tree(std::vector<Point_d>* locations, std::vector<Color>* colors) {
 		if (locations->size() != colors->size())
 			throw std::logic_error("Cannot create range tree on list of locations with different length than list of colors");
 
 		int count = locations->size();
 
-		std::vector<RangeTree::RTPoint<Color>> points = { };
+		std::vector<RangeTree::RTPoint<Id>> points = { };
 		for (int i = 0; i < count; i++) {
-			points.push_back(RangeTree::RTPoint<Color>((*locations)[i], (*colors)[i]));
+			points.push_back(RangeTree::RTPoint<Id>((*locations)[i], i));
+		}
+
+		return RangeTree::RangeTree<Id>(std::move(points));
+	}
+
+	template<class P>
+	static std::vector<NumTy> get_location_key(const P& location, int dims) {
+		std::vector<NumTy> key(dims);
+		for (int i = 0; i < dims; i++) {
+			key[i] = location[i];
+		}
+		return key;
+	}
+
+	static DuplicateIds generate_duplicate_ids(std::vector<Point_d>* locations) {
+		DuplicateIds ids = {};
+		for (int i = 0; i < locations->size(); i++) {
+			ids[get_location_key((*locations)[i], (*locations)[i].dimension())].push_back(i);
+		}
+
+		for (auto it = ids.begin(); it != ids.end(); ) {
+			if (it->second.size() == 1) it = ids.erase(it);
+			else it++;
 		}
+		return ids;
+	}
+
+	// Columnar store of the input points. The range tree, the radius search and the engines are all built from it,
+	// so the points need not be kept as Point_d as well, and the sorted coordinates exist only once.
+	typedef struct {
+		std::vector<NumTy> xs;
+		std::vector<NumTy> ys;
+		std::vector<Color> colors;
+		std::vector<NumTy> sorted_x; // with sentinels at both ends, as returned by generate_sorted_dim_pairs
+		std::vector<NumTy> sorted_y;
+		std::vector<Id> order_x; // ids by increasing x
+		std::vector<Id> order_y; // ids by increasing y
+	} PointStore;
+
+	static void sort_dim(std::vector<NumTy>* coords, std::vector<NumTy>* sorted, std::vector<Id>* order) {
+		order->resize(coords->size());
+		std::iota(order->begin(), order->end(), 0);
+		std::stable_sort(order->begin(), order->end(), [&](Id a, Id b) { return (*coords)[a] < (*coords)[b]; });
+
+		sorted->resize(coords->size() + 2);
+		(*sorted)[0] = std::numeric_limits<NumTy>::lowest();
+		(*sorted)[coords->size() + 1] = std::numeric_limits<NumTy>::max();
+		for (int i = 0; i < order->size(); i++) {
+			(*sorted)[i + 1] = (*coords)[(*order)[i]];
+		}
+	}
 
-		return RangeTree::RangeTree<Color>(points);
+	// Takes ownership of the columns
+	static PointStore generate_point_store(std::vector<NumTy> xs, std::vector<NumTy> ys, std::vector<Color> colors) {
+		if (xs.size() != ys.size() || xs.size() != colors.size())
+			throw std::logic_error("Cannot create point store on columns of different lengths");
+
+		PointStore store = {};
+		store.xs.swap(xs);
+		store.ys.swap(ys);
+		store.colors.swap(colors);
+		sort_dim(&store.xs, &store.sorted_x, &store.order_x);
+		sort_dim(&store.ys, &store.sorted_y, &store.order_y);
+		return store;
+	}
+
+	static PointStore generate_point_store(std::vector<Point_d>* locations, std::vector<Color>* colors) {
+		std::vector<NumTy> xs(locations->size()), ys(locations->size());
+		for (int i = 0; i < locations->size(); i++) {
+			xs[i] = (*locations)[i].x();
+			ys[i] = (*locations)[i].y();
+		}
+		return generate_point_store(std::move(xs), std::move(ys), *colors);
+	}
+
+	static RangeTree::RangeTree<Id> generate_tree(PointStore* store) {
+		std::vector<RangeTree::RTPoint<Id>> points = { };
+		points.reserve(store->xs.size());
+		for (int i = 0; i < store->xs.size(); i++) {
+			points.push_back(RangeTree::RTPoint<Id>(Point_d({ store->xs[i], store->ys[i] }), i));
+		}
+
+		return RangeTree::RangeTree<Id>(std::move(points));
+	}
+
+	static DuplicateIds generate_duplicate_ids(PointStore* store) {
+		DuplicateIds ids = {};
+		// sorted by x and then y, points at the same location are adjacent
+		std::vector<Id> order = store->order_x;
+		std::stable_sort(order.begin(), order.end(), [&](Id a, Id b) {
+			return std::make_pair(store->xs[a], store->ys[a]) < std::make_pair(store->xs[b], store->ys[b]);
+		});
+
+		for (int i = 0; i < order.size(); ) {
+			int j = i + 1;
+			while (j < order.size() && store->xs[order[j]] == store->xs[order[i]] && store->ys[order[j]] == store->ys[order[i]]) j++;
+			if (j - i > 1) {
+				auto& location_ids = ids[{ store->xs[order[i]], store->ys[order[i]] }];
+				location_ids.assign(order.begin() + i, order.begin() + j);
+				std::sort(location_ids.begin(), location_ids.end());
+			}
+			i = j;
+		}
+		return ids;
 	}
 
 	static std::vector<NumTy> get_sorted_dim_values(std::vector<pair_ni>* sorted_dim_pairs) {
@@ -35,9 +156,6 @@ namespace N2D {
 	}
 
 	static std::vector<pair_ni> generate_sorted_dim_pairs(std::vector<Point_d>* locations, uint dim) {
-		if (dim > 1)
-			throw std::logic_error("Queries with |dims| > 2 are not tested; proceed with caution.");
-
 		std::vector<pair_ni> sorted_dim_pairs(locations->size() + 2);
 		sorted_dim_pairs[0] = pair_ni(std::numeric_limits<NumTy>::lowest(), -1);
 		sorted_dim_pairs[locations->size() + 1] = pair_ni(std::numeric_limits<NumTy>::max(), locations->size());
@@ -54,109 +172,397 @@ namespace N2D {
 		return sorted_dim_pairs;
 	}
 
-	static std::pair<NumTy, double> get_smallest_distance_lower(Tree tree, std::vector<NumTy>* sorted, Point_d q, int k, uint dim) {
-		if (dim > 1)
-			throw std::logic_error("Not tested on dim > 2");
+	// The L-infinity box of the given radius around q.
+	// A radius |q - c| computed in floating point does not give back c exactly as q - radius or q + radius, so the box
+	// is widened by the rounding error to make sure it contains the coordinate the radius was taken from.
+	static std::pair<Point_d, Point_d> get_box(Point_d q, NumTy radius) {
+		std::vector<NumTy> lower(q.dimension()), upper(q.dimension());
+		for (int i = 0; i < q.dimension(); i++) {
+			NumTy slack = 2 * std::numeric_limits<NumTy>::epsilon() * (std::abs(q[i]) + radius);
+			lower[i] = q[i] - radius - slack;
+			upper[i] = q[i] + radius + slack;
+		}
+		return { Point_d(lower), Point_d(upper) };
+	}
 
-		// find index of first item smaller than or equal to query point.x
-		int l = 0;
-		int u = std::distance(sorted->begin(), std::lower_bound(sorted->begin(), sorted->end(), q[dim]));
-		int res = -1;
-		int rt_bin_searches = 0;
-		std::vector<long> bin_search_iteration_time = {};
+	// Distances from q along one dimension to the sorted coordinates on one side of q, in increasing order
+	typedef struct {
+		std::vector<NumTy>* sorted;
+		int start; // index of the coordinate nearest to q
+		int step; // -1 walks towards smaller coordinates, 1 towards larger ones
+		int size;
+		NumTy origin;
+	} DistanceSequence;
+
+	static NumTy get_sequence_distance(DistanceSequence* sequence, int i) {
+		return std::abs(sequence->origin - (*sequence->sorted)[sequence->start + sequence->step * i]);
+	}
 
-		while (l <= u) {
-			auto start = std::chrono::high_resolution_clock::now();
+	// Splits the sorted coordinates (without sentinels) of a dimension at q into two increasing distance sequences
+	static void add_distance_sequences(std::vector<DistanceSequence>* sequences, std::vector<NumTy>* sorted, Point_d q, uint dim) {
+		int split = std::distance(sorted->begin(), std::lower_bound(sorted->begin() + 1, sorted->end() - 1, q[dim]));
+		sequences->push_back({ sorted, split - 1, -1, split - 1, q[dim] });
+		sequences->push_back({ sorted, split, 1, (int)sorted->size() - 1 - split, q[dim] });
+	}
 
-			int m = (l + u) / 2;
-			NumTy distance = std::abs(q[dim] - (*sorted)[m]);
+	// Returns the r-th (0-indexed) smallest distance over all sequences, without merging them.
+	// Every round discards a prefix of one sequence that lies entirely among the r + 1 smallest distances,
+	// so it takes O(|sequences|^2 log n) comparisons and no range tree queries.
+	static NumTy select_distance(std::vector<DistanceSequence>* sequences, int r) {
+		std::vector<int> offsets(sequences->size(), 0);
+		int t = r + 1;
+
+		while (true) {
+			int active = 0;
+			for (int i = 0; i < sequences->size(); i++) {
+				if (offsets[i] < (*sequences)[i].size) active++;
+			}
+
+			int best = -1, best_take = 0;
+			NumTy best_distance = 0;
+			for (int i = 0; i < sequences->size(); i++) {
+				int remaining = (*sequences)[i].size - offsets[i];
+				if (remaining <= 0) continue;
+
+				int take = std::min(remaining, std::max(1, t / active));
+				NumTy distance = get_sequence_distance(&(*sequences)[i], offsets[i] + take - 1);
+				if (best == -1 || distance < best_distance) {
+					best = i;
+					best_take = take;
+					best_distance = distance;
+				}
+			}
+
+			if (best_take == t) {
+				return best_distance;
+			}
+			offsets[best] += best_take;
+			t -= best_take;
+		}
+	}
+
+	// Returns the number of candidate distances over all sequences that are smaller than the given distance
+	static int rank_distance(std::vector<DistanceSequence>* sequences, NumTy distance) {
+		int rank = 0;
+		for (auto& sequence : *sequences) {
+			int l = 0, u = sequence.size;
+			while (l < u) {
+				int m = (l + u) / 2;
+				if (get_sequence_distance(&sequence, m) < distance) l = m + 1;
+				else u = m;
+			}
+			rank += l;
+		}
+		return rank;
+	}
+
+	// Returns the smallest L-infinity radius around q that contains at least k points, in as many dimensions as q.
+	// The radius is always the distance from q to some coordinate, so we binary search over the ranks of these
+	// candidate distances. In 2D this needs about log(2n) range counts, compared to four binary searches over the
+	// x and y coordinates on either side of q.
+	// Given a positive hint radius, e.g. the radius of a nearby previous query, the search instead gallops from the
+	// rank of the hint, doubling its step until the answer is bracketed. This takes about 2 log(d) range counts,
+	// where d is the difference in rank between the hint and the answer.
+	static NumTy get_smallest_distance(Tree tree, SortedDims* sorted, Point_d q, int k, NumTy hint = 0) {
+		INSTRUMENT_TIME(RadiusSearchTime);
+		INSTRUMENT_COUNT(RadiusSearches, 1);
+
+		if (sorted->size() != q.dimension())
+			throw std::logic_error("Radius search needs the sorted coordinates of every dimension of the query");
+
+		std::vector<DistanceSequence> sequences = {};
+		for (uint dim = 0; dim < sorted->size(); dim++) {
+			add_distance_sequences(&sequences, (*sorted)[dim], q, dim);
+		}
 
-			Point_d lower({ q.x() - distance, q.y() - distance }), upper({ q.x() + distance, q.y() + distance });
+		int total = 0;
+		for (int i = 0; i < sequences.size(); i++) {
+			total += sequences[i].size;
+		}
+		if (total == 0) return std::numeric_limits<NumTy>::max();
+
+		auto contains_k = [&](int m) {
+			INSTRUMENT_COUNT(RadiusSearchIterations, 1);
+			INSTRUMENT_COUNT(RangeCounts, 1);
 
-			auto query_res = tree->countInRange(lower, upper);
-			auto count = query_res.first;
-			rt_bin_searches++;
+			auto box = get_box(q, select_distance(&sequences, m));
+			return tree->countInRange(box.first, box.second).first >= k;
+		};
 
-			if (count >= k) {
-				res = m;
-				l = m + 1;
+		// ranks up to l are known to contain fewer than k points, ranks from u on at least k
+		int l = -1, u = total;
+		if (hint > 0) {
+			int start = std::min(rank_distance(&sequences, hint), total - 1);
+			if (contains_k(start)) {
+				u = start;
+				for (int step = 1; u > 0; step *= 2) {
+					int m = std::max(u - step, 0);
+					if (!contains_k(m)) {
+						l = m;
+						break;
+					}
+					u = m;
+				}
 			}
 			else {
-				u = m - 1;
+				l = start;
+				for (int step = 1; l < total - 1; step *= 2) {
+					int m = std::min(l + step, total - 1);
+					if (contains_k(m)) {
+						u = m;
+						break;
+					}
+					l = m;
+				}
 			}
+		}
 
-			auto end = std::chrono::high_resolution_clock::now();
-			bin_search_iteration_time.push_back(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+		while (u - l > 1) {
+			int m = (l + u) / 2;
+			if (contains_k(m)) u = m;
+			else l = m;
 		}
+		if (u == total) return std::numeric_limits<NumTy>::max();
+		return select_distance(&sequences, u);
+	}
 
-		auto avg_time_per_iteration = ((double)(std::accumulate(
-			bin_search_iteration_time.begin(),
-			bin_search_iteration_time.end(),
-			0.0) / rt_bin_searches));
+	static NumTy get_smallest_distance(Tree tree, std::vector<NumTy>* sorted_x, std::vector<NumTy>* sorted_y, Point_d q, int k, NumTy hint = 0) {
+		SortedDims sorted = { sorted_x, sorted_y };
+		return get_smallest_distance(tree, &sorted, q, k, hint);
+	}
 
-		if (res == -1) {
-			return std::pair<NumTy, double>(std::numeric_limits<NumTy>::max(), avg_time_per_iteration);
-		}
+	// Returns radius from q. A radius from a nearby query can be passed as hint to speed up the search.
+	static NumTy query_k_nearest(Tree tree, std::vector<NumTy>* sorted_x, std::vector<NumTy>* sorted_y, Point_d q, int k, NumTy hint = 0) {
+		return get_smallest_distance(tree, sorted_x, sorted_y, q, k, hint);
+	}
 
-		return std::pair<NumTy, double>(std::abs(q[dim] - (*sorted)[res]), avg_time_per_iteration);
+	static NumTy query_k_nearest(Tree tree, SortedDims* sorted, Point_d q, int k, NumTy hint = 0) {
+		return get_smallest_distance(tree, sorted, q, k, hint);
 	}
 
-	static std::pair<NumTy, double> get_smallest_distance_upper(Tree tree, std::vector<NumTy>* sorted, Point_d q, int k, uint dim) {
-		if (dim > 1)
-			throw std::logic_error("Not tested on dim > 2");
+	static NumTy get_distance(NumTy dx, NumTy dy, Metric metric) {
+		dx = std::abs(dx);
+		dy = std::abs(dy);
+		return metric == Metric::Euclidean ? std::sqrt(dx * dx + dy * dy) : std::max(dx, dy);
+	}
 
-		// find index of first item smaller than or equal to query point.x
-		int l = std::distance(sorted->begin(), std::upper_bound(sorted->begin(), sorted->end(), q[dim]));
-		int u = sorted->size() - 1;
-		int res = -1;
-		int rt_bin_searches = 0;
+	static NumTy get_distance(const RangeTree::RTPoint<Id>& point, Point_d q, Metric metric) {
+		NumTy distance = 0;
+		for (int i = 0; i < q.dimension(); i++) {
+			NumTy d = std::abs(point[i] - q[i]);
+			distance = metric == Metric::Euclidean ? distance + d * d : std::max(distance, d);
+		}
+		return metric == Metric::Euclidean ? std::sqrt(distance) : distance;
+	}
 
-		std::vector<long> bin_search_iteration_time = {};
+	// Selects the k smallest (distance, id) candidates and the mode of their colors
+	static NearestResult select_nearest(std::vector<std::pair<NumTy, Id>>* candidates, std::vector<Color>* colors, int k) {
+		NearestResult result = { std::numeric_limits<NumTy>::max(), {}, -1, 0 };
 
-		while (l <= u) {
-			auto start = std::chrono::high_resolution_clock::now();
+		int found = std::min(k, (int)candidates->size());
+		std::partial_sort(candidates->begin(), candidates->begin() + found, candidates->end());
+		if (found == k && k > 0) result.radius = (*candidates)[k - 1].first;
 
-			int m = (l + u) / 2;
-			NumTy distance = std::abs(q[dim] - (*sorted)[m]);
-
-			Point_d lower({ q.x() - distance, q.y() - distance }), upper({ q.x() + distance, q.y() + distance });
-			auto query_res = tree->countInRange(lower, upper);
-			auto count = query_res.first;
-			rt_bin_searches++;
-			if (count >= k) {
-				res = m;
-				u = m - 1;
+		std::map<Color, int> frequencies = {};
+		for (int i = 0; i < found; i++) {
+			result.neighbours.push_back((*candidates)[i].second);
+			frequencies[(*colors)[(*candidates)[i].second]]++;
+		}
+		for (auto& frequency : frequencies) {
+			if (frequency.second > result.frequency) {
+				result.mode = frequency.first;
+				result.frequency = frequency.second;
+			}
+		}
+		return result;
+	}
+
+	// Reports every point within the L-infinity box of the given radius around q, as (distance, id) pairs
+	static void collect_candidates(
+		Tree tree,
+		DuplicateIds* duplicates,
+		Point_d q,
+		NumTy radius,
+		Metric metric,
+		std::vector<std::pair<NumTy, Id>>* candidates
+	) {
+		auto box = get_box(q, radius);
+		auto points = tree->pointsInRange(box.first, box.second);
+
+		candidates->clear();
+		for (auto& point : points) {
+			NumTy point_distance = get_distance(point, q, metric);
+			if (point.count() == 1) {
+				candidates->push_back({ point_distance, point.value() });
 			}
 			else {
-				l = m + 1;
+				for (auto id : duplicates->at(get_location_key(point, q.dimension()))) {
+					candidates->push_back({ point_distance, id });
+				}
 			}
+		}
+	}
 
-			auto end = std::chrono::high_resolution_clock::now();
-			bin_search_iteration_time.push_back(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+	// Returns the k nearest points to q and the mode of their colors.
+	// The radius search only counts, so the points within the radius are reported by a single range query afterwards.
+	// For the euclidean metric, the k nearest points lie within sqrt(d) times the L-infinity radius in d dimensions,
+	// so the candidates of that box are reported and the k smallest euclidean distances selected from them.
+	// Points at the same distance are ordered by id, so ties on the boundary always resolve the same way.
+	// The hint is an L-infinity radius, see get_smallest_distance.
+	static NearestResult query_k_nearest_mode(
+		Tree tree,
+		SortedDims* sorted,
+		DuplicateIds* duplicates,
+		std::vector<Color>* colors,
+		Point_d q,
+		int k,
+		Metric metric = Metric::LInfinity,
+		NumTy hint = 0
+	) {
+		NumTy distance = get_smallest_distance(tree, sorted, q, k, hint);
+		if (metric == Metric::Euclidean && distance != std::numeric_limits<NumTy>::max()) {
+			// round up, such that no point on the sphere is lost to rounding
+			distance = std::nextafter(distance * std::sqrt(NumTy(q.dimension())), std::numeric_limits<NumTy>::max());
 		}
+		// reused across queries on the same thread
+		thread_local std::vector<std::pair<NumTy, Id>> candidates;
+		collect_candidates(tree, duplicates, q, distance, metric, &candidates);
+		return select_nearest(&candidates, colors, k);
+	}
 
-		auto avg_time_per_iteration = ((double)(std::accumulate(
-			bin_search_iteration_time.begin(),
-			bin_search_iteration_time.end(),
-			0.0) / rt_bin_searches)); // us
+	static NearestResult query_k_nearest_mode(
+		Tree tree,
+		std::vector<NumTy>* sorted_x,
+		std::vector<NumTy>* sorted_y,
+		DuplicateIds* duplicates,
+		std::vector<Color>* colors,
+		Point_d q,
+		int k,
+		Metric metric = Metric::LInfinity,
+		NumTy hint = 0
+	) {
+		SortedDims sorted = { sorted_x, sorted_y };
+		return query_k_nearest_mode(tree, &sorted, duplicates, colors, q, k, metric, hint);
+	}
 
-		if (res == -1) {
-			return std::pair<NumTy, double>(std::numeric_limits<NumTy>::max(), avg_time_per_iteration);
+	// A radius within a factor (1 + epsilon) of the distance to the k-th nearest point, with the mode of the points within it
+	typedef struct {
+		NumTy lower; // the distance to the k-th nearest point lies in (lower, radius], or is exactly radius if lower == radius
+		NumTy radius; // max() if there are fewer than k points
+		Color mode; // the smallest color among those with the highest frequency within radius
+		int frequency;
+	} ApproximateResult;
+
+	// Returns (lower, radius) such that the smallest L-infinity radius r* around q that contains k points lies in
+	// (lower, radius], with radius <= (1 + epsilon) r*. Rather than over the ranks of all candidate distances, this binary
+	// searches the geometric grid r_j = r_0 (1 + epsilon)^j, where r_0 is the smallest positive candidate distance and
+	// the grid ends at the largest one. r* is a candidate distance, so it is 0 or at least r_0, and the search takes
+	// about log(log(r_max / r_0) / epsilon) range counts without selecting any distances.
+	static std::pair<NumTy, NumTy> get_approximate_distance(Tree tree, SortedDims* sorted, Point_d q, int k, NumTy epsilon) {
+		INSTRUMENT_TIME(RadiusSearchTime);
+		INSTRUMENT_COUNT(RadiusSearches, 1);
+
+		if (sorted->size() != q.dimension())
+			throw std::logic_error("Radius search needs the sorted coordinates of every dimension of the query");
+		if (epsilon <= 0)
+			throw std::logic_error("Approximate radius search needs a positive epsilon");
+
+		std::vector<DistanceSequence> sequences = {};
+		for (uint dim = 0; dim < sorted->size(); dim++) {
+			add_distance_sequences(&sequences, (*sorted)[dim], q, dim);
 		}
 
-		return std::pair<NumTy, double>(std::abs(q[dim] - (*sorted)[res]), avg_time_per_iteration);
+		auto contains_k = [&](NumTy distance) {
+			INSTRUMENT_COUNT(RadiusSearchIterations, 1);
+			INSTRUMENT_COUNT(RangeCounts, 1);
+
+			auto box = get_box(q, distance);
+			return tree->countInRange(box.first, box.second).first >= k;
+		};
+
+		NumTy r_0 = std::numeric_limits<NumTy>::max(), r_max = 0;
+		for (auto& sequence : sequences) {
+			if (sequence.size == 0) continue;
+			r_max = std::max(r_max, get_sequence_distance(&sequence, sequence.size - 1));
+
+			// skip the coordinates equal to q's
+			int l = 0, u = sequence.size;
+			while (l < u) {
+				int m = (l + u) / 2;
+				if (get_sequence_distance(&sequence, m) == 0) l = m + 1;
+				else u = m;
+			}
+			if (l < sequence.size) r_0 = std::min(r_0, get_sequence_distance(&sequence, l));
+		}
+
+		// the sorted coordinates hold all points, plus two sentinels
+		NumTy none = std::numeric_limits<NumTy>::max();
+		if ((int)(*sorted)[0]->size() - 2 < k) return { none, none };
+		if (r_max == 0) return { 0, 0 };
+
+		// the grid starts with radius 0 at j = -1, and its last radius contains all points
+		auto grid = [&](int j) {
+			return j < 0 ? 0 : std::min(r_0 * std::pow(1 + epsilon, j), r_max);
+		};
+
+		// grid radii up to l contain fewer than k points, radii from u on at least k
+		int l = -2, u = (int)std::ceil(std::log(r_max / r_0) / std::log1p(epsilon));
+		while (u - l > 1) {
+			int m = (l + u) / 2;
+			if (contains_k(grid(m))) u = m;
+			else l = m;
+		}
+		return { u == 0 ? r_0 : grid(u - 1), grid(u) };
 	}
 
-	// Returns radius from q
-	static std::pair<NumTy, double> query_k_nearest(Tree tree, std::vector<NumTy>* sorted_x, std::vector<NumTy>* sorted_y, Point_d q, int k) {
-		auto x_lower = get_smallest_distance_lower(tree, sorted_x, q, k, 0);
-		auto y_lower = get_smallest_distance_lower(tree, sorted_y, q, k, 1);
-		auto x_upper = get_smallest_distance_upper(tree, sorted_x, q, k, 0);
-		auto y_upper = get_smallest_distance_upper(tree, sorted_y, q, k, 1);
+	// Returns a radius within a factor (1 + epsilon) of the k-th nearest distance, and the mode of all points within it.
+	// The mode is taken over at least the k nearest points, plus those that are at most a factor (1 + epsilon) further.
+	static ApproximateResult query_approximate_k_nearest_mode(
+		Tree tree,
+		SortedDims* sorted,
+		DuplicateIds* duplicates,
+		std::vector<Color>* colors,
+		Point_d q,
+		int k,
+		NumTy epsilon
+	) {
+		auto distance = get_approximate_distance(tree, sorted, q, k, epsilon);
+		ApproximateResult result = { distance.first, distance.second, -1, 0 };
+
+		auto box = get_box(q, distance.second);
+		auto points = tree->pointsInRange(box.first, box.second);
+
+		std::map<Color, int> frequencies = {};
+		for (auto& point : points) {
+			if (point.count() == 1) {
+				frequencies[(*colors)[point.value()]]++;
+			}
+			else {
+				for (auto id : duplicates->at(get_location_key(point, q.dimension()))) {
+					frequencies[(*colors)[id]]++;
+				}
+			}
+		}
+		for (auto& frequency : frequencies) {
+			if (frequency.second > result.frequency) {
+				result.mode = frequency.first;
+				result.frequency = frequency.second;
+			}
+		}
+		return result;
+	}
 
-		return std::pair<NumTy, int>(
-			std::min({ x_lower.first, y_lower.first, x_upper.first, y_upper.first }),
-			x_lower.second + y_lower.second + x_upper.second + y_upper.second
-		);
+	static ApproximateResult query_approximate_k_nearest_mode(
+		Tree tree,
+		std::vector<NumTy>* sorted_x,
+		std::vector<NumTy>* sorted_y,
+		DuplicateIds* duplicates,
+		std::vector<Color>* colors,
+		Point_d q,
+		int k,
+		NumTy epsilon
+	) {
+		SortedDims sorted = { sorted_x, sorted_y };
+		return query_approximate_k_nearest_mode(tree, &sorted, duplicates, colors, q, k, epsilon);
 	}
-}
\ No newline at end of file
+}
@@ -45,6 +45,10 @@
 #include <deque>
 #include <cmath>
 #include <algorithm>
+#include <memory>
+#include <cstdint>
+#include <future>
+#include <thread>
 #include <CGAL/Cartesian_d.h>
 #include <CGAL/Kernel_d/Point_d.h>
 
@@ -55,6 +59,24 @@ typedef CGAL::Cartesian_d<NumTy>::Point_d Point_d;
 
 namespace RangeTree {
 
+    template <class S>
+    class RangeTreeImage;
+
+    /**
+    * How a RangeTree stores its fractional cascading arrays.
+    *
+    * Full keeps separate >= and <= bridge pointers into both children for every point, as described
+    * in de Berg et al. Compact replaces these four arrays by a single array that counts how many of
+    * the first i points went to the left child, and omits the cumulative counts at nodes without
+    * duplicate points. CountOnly additionally drops the sorted points of every node, so pointsInRange(...)
+    * is unavailable.
+    */
+    enum class Storage {
+        Full,
+        Compact,
+        CountOnly,
+    };
+
     /**
     * A point in euclidean space.
     *
@@ -383,6 +405,11 @@ namespace RangeTree {
                         rearrangeGivenOrder(pointsSortedByCurrentDim, order);
                     }
                 }
+                else if (sortDimension != currentDim) {
+                    // Merging duplicates left too few points for redirection tables, so the points
+                    // are still sorted on the last dimension.
+                    sort(pointsSortedByCurrentDim, currentDim);
+                }
             }
         }
 
@@ -499,6 +526,8 @@ namespace RangeTree {
     */
     template <class S>
     class RangeTreeNode {
+        friend class RangeTreeImage<S>;
+
     private:
         std::shared_ptr<RangeTreeNode<S> > left; /**< Contains points <= the comparison point **/
         std::shared_ptr<RangeTreeNode<S> > right; /**< Contains points > the comparison point **/
@@ -516,6 +545,35 @@ namespace RangeTree {
         std::vector<int> pointerToGeqRight;
         std::vector<int> pointerToLeqRight;
         std::vector<int> cumuCountPoints;
+        std::vector<uint32_t> leftRank; /**< Number of the first i points in the left child, only for compact storage **/
+        Storage storage;
+
+        static const int MIN_POINTS_BEFORE_FORK = 1 << 13; /**< Subtrees smaller than this are built on the calling thread **/
+
+        /**
+        * A query of a batch along with the half-open range [begin, end) of points of the current node,
+        * sorted on the last dimension, that it still has to consider.
+        */
+        struct BatchEntry {
+            int query;
+            int begin;
+            int end;
+        };
+
+        /**
+        * Cascades the half-open range [begin, end) of this node to the corresponding range of a child.
+        * Requires begin < end.
+        */
+        void cascadeRange(bool toLeft, int begin, int end, int& childBegin, int& childEnd) const {
+            if (storage == Storage::Full) {
+                childBegin = toLeft ? pointerToGeqLeft[begin] : pointerToGeqRight[begin];
+                childEnd = (toLeft ? pointerToLeqLeft[end - 1] : pointerToLeqRight[end - 1]) + 1;
+            }
+            else {
+                childBegin = toLeft ? leftRank[begin] : begin - leftRank[begin];
+                childEnd = toLeft ? leftRank[end] : end - leftRank[end];
+            }
+        }
 
     public:
         /**
@@ -524,28 +582,50 @@ namespace RangeTree {
         * Creates a range tree structure on the input collection \allPoints using the lexicographic order
         * starting at \compareStartInd.
         *
+        * While \forkDepth > 0 and the node holds at least MIN_POINTS_BEFORE_FORK unique points, the left
+        * subtree is built on a separate thread while the right subtree is built on the calling thread.
+        * Both halves only read the shared points, so the resulting tree is identical to a serial build.
+        *
         * @param uniquePoints a collection of points.
+        * @param forkDepth the number of levels below this node at which subtree construction may still fork.
+        * @param storage how to store the fractional cascading arrays.
         * @return a range tree structure
         */
         RangeTreeNode(SortedPointMatrix<S>& spm,
             bool onLeftEdge = true,
-            bool onRightEdge = true) : pointOrdering(spm.getCurrentDim()) {
+            bool onRightEdge = true,
+            int forkDepth = 0,
+            Storage storage = Storage::Full) : pointOrdering(spm.getCurrentDim()), storage(storage) {
             point = spm.getMidPoint();
 
             if (spm.numUniquePoints() == 1) {
                 isLeaf = true;
                 pointCountSum = point->count();
-                pointsLastDimSorted.push_back((*point)[point->dim() - 1]);
+                if (storage == Storage::Full) {
+                    pointsLastDimSorted.push_back((*point)[point->dim() - 1]);
+                }
                 if (spm.getCurrentDim() == point->dim() - 2) {
                     spm.moveToNextDimension();
                 }
             }
             else {
                 auto spmPair = spm.splitOnMid();
-                left = std::shared_ptr<RangeTreeNode<S> >(
-                    new RangeTreeNode<S>(spmPair.first, onLeftEdge, false));
-                right = std::shared_ptr<RangeTreeNode<S> >(
-                    new RangeTreeNode<S>(spmPair.second, false, onRightEdge));
+                if (forkDepth > 0 && spm.numUniquePoints() >= MIN_POINTS_BEFORE_FORK) {
+                    SortedPointMatrix<S>& spmLeft = spmPair.first;
+                    std::future<RangeTreeNode<S>* > leftFuture = std::async(std::launch::async,
+                        [&spmLeft, onLeftEdge, forkDepth, storage]() {
+                        return new RangeTreeNode<S>(spmLeft, onLeftEdge, false, forkDepth - 1, storage);
+                    });
+                    right = std::shared_ptr<RangeTreeNode<S> >(
+                        new RangeTreeNode<S>(spmPair.second, false, onRightEdge, forkDepth - 1, storage));
+                    left = std::shared_ptr<RangeTreeNode<S> >(leftFuture.get());
+                }
+                else {
+                    left = std::shared_ptr<RangeTreeNode<S> >(
+                        new RangeTreeNode<S>(spmPair.first, onLeftEdge, false, 0, storage));
+                    right = std::shared_ptr<RangeTreeNode<S> >(
+                        new RangeTreeNode<S>(spmPair.second, false, onRightEdge, 0, storage));
+                }
                 pointCountSum = left->totalPoints() + right->totalPoints();
 
                 int dim = point->dim();
@@ -558,17 +638,34 @@ namespace RangeTree {
                         pointsLastDimSorted.push_back((*allPointsSorted[i])[dim - 1]);
                         cumuCountPoints.push_back(cumuCountPoints.back() + allPointsSorted[i]->count());
                     }
-                    const auto& leftSorted = left->pointsLastDimSorted;
-                    const auto& rightSorted = right->pointsLastDimSorted;
 
-                    pointerToGeqLeft = createGeqPointers(pointsLastDimSorted, leftSorted);
-                    pointerToGeqRight = createGeqPointers(pointsLastDimSorted, rightSorted);
-                    pointerToLeqLeft = createLeqPointers(pointsLastDimSorted, leftSorted);
-                    pointerToLeqRight = createLeqPointers(pointsLastDimSorted, rightSorted);
+                    if (storage == Storage::Full) {
+                        const auto& leftSorted = left->pointsLastDimSorted;
+                        const auto& rightSorted = right->pointsLastDimSorted;
+
+                        pointerToGeqLeft = createGeqPointers(pointsLastDimSorted, leftSorted);
+                        pointerToGeqRight = createGeqPointers(pointsLastDimSorted, rightSorted);
+                        pointerToLeqLeft = createLeqPointers(pointsLastDimSorted, leftSorted);
+                        pointerToLeqRight = createLeqPointers(pointsLastDimSorted, rightSorted);
+                    }
+                    else {
+                        // The left child holds exactly the points <= the comparison point
+                        leftRank.resize(allPointsSorted.size() + 1);
+                        leftRank[0] = 0;
+                        for (int i = 0; i < allPointsSorted.size(); i++) {
+                            leftRank[i + 1] = leftRank[i] + (pointOrdering.lessOrEq(*allPointsSorted[i], *point) ? 1 : 0);
+                        }
+                        if (cumuCountPoints.back() == allPointsSorted.size()) {
+                            std::vector<int>().swap(cumuCountPoints);
+                        }
+                        if (storage == Storage::CountOnly) {
+                            std::vector<RTPoint<S>* >().swap(allPointsSorted);
+                        }
+                    }
                 }
                 else if (!onLeftEdge && !onRightEdge && spm.getCurrentDim() + 1 != point->dim()) {
                     spm.moveToNextDimension();
-                    treeOnNextDim = std::shared_ptr<RangeTreeNode>(new RangeTreeNode(spm));
+                    treeOnNextDim = std::shared_ptr<RangeTreeNode>(new RangeTreeNode(spm, true, true, 0, storage));
                 }
                 isLeaf = false;
             }
@@ -636,6 +733,168 @@ namespace RangeTree {
             }
         }
 
+        /**
+        * Number of points, counting multiplicities, among the points [begin, end) of this node sorted
+        * on the last dimension.
+        */
+        int countInCascadeRange(int begin, int end) const {
+            if (begin >= end) {
+                return 0;
+            }
+            if (isLeaf) {
+                return totalPoints();
+            }
+            if (cumuCountPoints.empty()) {
+                return end - begin;
+            }
+            return cumuCountPoints[end] - cumuCountPoints[begin];
+        }
+
+        /**
+        * Count the points in range for a batch of queries, adding each count to \counts.
+        *
+        * All queries of the batch descend the tree together: at every node the batch is split into the
+        * queries that continue left, continue right, or split at the node. Queries that split at a node
+        * of the last-but-one dimension are resolved by batched fractional cascading, other queries that
+        * split fall back to countInRange(...).
+        *
+        * @param queries indices into \lowers and \uppers of the queries in this batch.
+        * @param lowers the lower bounds of all rectangles.
+        * @param uppers the upper bounds of all rectangles.
+        * @param counts the counts of all rectangles.
+        */
+        void batchCountInRange(const std::vector<int>& queries,
+            const std::vector<Point_d>& lowers,
+            const std::vector<Point_d>& uppers,
+            std::vector<int>& counts) const {
+            if (queries.empty()) {
+                return;
+            }
+            if (isLeaf) {
+                for (int i = 0; i < queries.size(); i++) {
+                    if (pointInRange(*point, lowers[queries[i]], uppers[queries[i]])) {
+                        counts[queries[i]] += totalPoints();
+                    }
+                }
+                return;
+            }
+
+            int compareInd = pointOrdering.getCompareStartIndex();
+            int lastDim = point->dim() - 1;
+            std::vector<int> toLeft, toRight;
+            std::vector<BatchEntry> leftCascade, rightCascade;
+            for (int i = 0; i < queries.size(); i++) {
+                int q = queries[i];
+                if ((*point)[compareInd] > uppers[q][compareInd]) {
+                    toLeft.push_back(q);
+                }
+                else if ((*point)[compareInd] < lowers[q][compareInd]) {
+                    toRight.push_back(q);
+                }
+                else if (compareInd + 1 == lastDim) {
+                    int begin = std::lower_bound(pointsLastDimSorted.begin(), pointsLastDimSorted.end(), lowers[q][lastDim]) -
+                        pointsLastDimSorted.begin();
+                    int end = std::upper_bound(pointsLastDimSorted.begin(), pointsLastDimSorted.end(), uppers[q][lastDim]) -
+                        pointsLastDimSorted.begin();
+                    if (begin < end) {
+                        BatchEntry entry = { q, 0, 0 };
+                        cascadeRange(true, begin, end, entry.begin, entry.end);
+                        leftCascade.push_back(entry);
+                        cascadeRange(false, begin, end, entry.begin, entry.end);
+                        rightCascade.push_back(entry);
+                    }
+                }
+                else {
+                    counts[q] += countInRange(lowers[q], uppers[q]).first;
+                }
+            }
+
+            left->batchLeftCascade(leftCascade, lowers, counts);
+            right->batchRightCascade(rightCascade, uppers, counts);
+            left->batchCountInRange(toLeft, lowers, uppers, counts);
+            right->batchCountInRange(toRight, lowers, uppers, counts);
+        }
+
+        /**
+        * Batched version of leftFractionalCascade(...).
+        */
+        void batchLeftCascade(const std::vector<BatchEntry>& entries,
+            const std::vector<Point_d>& lowers,
+            std::vector<int>& counts) const {
+            if (entries.empty()) {
+                return;
+            }
+
+            int compareInd = point->dim() - 2;
+            std::vector<BatchEntry> toLeft, toRight;
+            for (int i = 0; i < entries.size(); i++) {
+                BatchEntry entry = entries[i];
+                if (entry.begin >= entry.end) {
+                    continue;
+                }
+                if (lowers[entry.query][compareInd] <= (*point)[compareInd]) {
+                    if (isLeaf) {
+                        counts[entry.query] += totalPoints();
+                        continue;
+                    }
+                    int beginRight, endRight;
+                    cascadeRange(false, entry.begin, entry.end, beginRight, endRight);
+                    counts[entry.query] += right->countInCascadeRange(beginRight, endRight);
+                    cascadeRange(true, entry.begin, entry.end, entry.begin, entry.end);
+                    toLeft.push_back(entry);
+                }
+                else if (!isLeaf) {
+                    cascadeRange(false, entry.begin, entry.end, entry.begin, entry.end);
+                    toRight.push_back(entry);
+                }
+            }
+
+            if (!isLeaf) {
+                left->batchLeftCascade(toLeft, lowers, counts);
+                right->batchLeftCascade(toRight, lowers, counts);
+            }
+        }
+
+        /**
+        * Batched version of rightFractionalCascade(...).
+        */
+        void batchRightCascade(const std::vector<BatchEntry>& entries,
+            const std::vector<Point_d>& uppers,
+            std::vector<int>& counts) const {
+            if (entries.empty()) {
+                return;
+            }
+
+            int compareInd = point->dim() - 2;
+            std::vector<BatchEntry> toLeft, toRight;
+            for (int i = 0; i < entries.size(); i++) {
+                BatchEntry entry = entries[i];
+                if (entry.begin >= entry.end) {
+                    continue;
+                }
+                if ((*point)[compareInd] <= uppers[entry.query][compareInd]) {
+                    if (isLeaf) {
+                        counts[entry.query] += totalPoints();
+                        continue;
+                    }
+                    int beginLeft, endLeft;
+                    cascadeRange(true, entry.begin, entry.end, beginLeft, endLeft);
+                    counts[entry.query] += left->countInCascadeRange(beginLeft, endLeft);
+                    cascadeRange(false, entry.begin, entry.end, entry.begin, entry.end);
+                    toRight.push_back(entry);
+                }
+                else if (!isLeaf) {
+                    cascadeRange(true, entry.begin, entry.end, entry.begin, entry.end);
+                    toLeft.push_back(entry);
+                }
+            }
+
+            if (!isLeaf) {
+                left->batchRightCascade(toLeft, uppers, counts);
+                right->batchRightCascade(toRight, uppers, counts);
+            }
+        }
+
         /**
         * Construct a RangeTreeNode representing a leaf.
         *
@@ -644,7 +903,8 @@ namespace RangeTree {
         * @return
         */
         RangeTreeNode(RTPoint<S>* pointAtLeaf, int compareStartInd) :
-            point(pointAtLeaf), isLeaf(true), pointCountSum(pointAtLeaf->count()), pointOrdering(compareStartInd) {}
+            point(pointAtLeaf), isLeaf(true), pointCountSum(pointAtLeaf->count()), pointOrdering(compareStartInd),
+            storage(Storage::Full) {}
 
         /**
         * Total count of points at the leaves of the range tree rooted at this node.
@@ -734,6 +994,16 @@ namespace RangeTree {
             }
 
             int dim = point->dim();
+            if (compareInd + 2 == dim && storage != Storage::Full) {
+                std::vector<RangeTreeNode<S>* > nodes;
+                std::vector<std::pair<int, int> > inds;
+                compactCascade(lower, upper, nodes, inds);
+                int sum = 0;
+                for (int i = 0; i < nodes.size(); i++) {
+                    sum += nodes[i]->countInCascadeRange(inds[i].first, inds[i].second);
+                }
+                return std::pair<int, int>(sum, 2);
+            }
             if (compareInd + 2 == dim) {
                 int n = pointsLastDimSorted.size();
                 int geqInd = binarySearchFirstGeq(lower[lower.dimension() - 1], 0, n - 1);
@@ -831,6 +1101,25 @@ namespace RangeTree {
             }
 
             int dim = point->dim();
+            if (compareInd + 2 == dim && storage != Storage::Full) {
+                if (storage == Storage::CountOnly) {
+                    throw std::logic_error("Cannot return points in range from a count-only range tree.");
+                }
+                std::vector<RangeTreeNode<S>* > nodes;
+                std::vector<std::pair<int, int> > inds;
+                compactCascade(lower, upper, nodes, inds);
+                for (int i = 0; i < nodes.size(); i++) {
+                    if (nodes[i]->isLeaf) {
+                        pointsToReturn.push_back(*(nodes[i]->point));
+                    }
+                    else {
+                        for (int j = inds[i].first; j < inds[i].second; j++) {
+                            pointsToReturn.push_back(*(nodes[i]->allPointsSorted[j]));
+                        }
+                    }
+                }
+                return pointsToReturn;
+            }
             if (compareInd + 2 == dim) {
                 int n = pointsLastDimSorted.size();
                 int geqInd = binarySearchFirstGeq(lower[lower.dimension() - 1], 0, n - 1);
@@ -995,6 +1284,118 @@ namespace RangeTree {
             }
         }
 
+        /**
+        * Collects the canonical nodes of a query at its split node for compact storage, along with the
+        * half-open range [begin, end) of their points sorted on the last dimension that lie in the query.
+        *
+        * In contrast to the full storage, a range is cascaded to a child by counting how many of the
+        * points before \begin and \end went to that child, which is exact even when points share
+        * their last coordinate.
+        */
+        void compactCascade(const Point_d& lower,
+            const Point_d& upper,
+            std::vector<RangeTreeNode<S>* >& nodes,
+            std::vector<std::pair<int, int> >& inds) const {
+            int lastDim = lower.dimension() - 1;
+            int begin = std::lower_bound(pointsLastDimSorted.begin(), pointsLastDimSorted.end(), lower[lastDim]) -
+                pointsLastDimSorted.begin();
+            int end = std::upper_bound(pointsLastDimSorted.begin(), pointsLastDimSorted.end(), upper[lastDim]) -
+                pointsLastDimSorted.begin();
+            if (begin >= end) {
+                return;
+            }
+            left->compactLeftCascade(lower, leftRank[begin], leftRank[end], nodes, inds);
+            right->compactRightCascade(upper, begin - leftRank[begin], end - leftRank[end], nodes, inds);
+        }
+
+        void compactLeftCascade(const Point_d& lower,
+            int begin,
+            int end,
+            std::vector<RangeTreeNode<S>* >& nodes,
+            std::vector<std::pair<int, int> >& inds) {
+            if (begin >= end) {
+                return;
+            }
+
+            int compareInd = point->dim() - 2;
+
+            if (lower[compareInd] <= (*point)[compareInd]) {
+                if (isLeaf) {
+                    nodes.push_back(this);
+                    inds.push_back(std::pair<int, int>(0, 1));
+                    return;
+                }
+
+                int beginRight = begin - leftRank[begin];
+                int endRight = end - leftRank[end];
+                if (beginRight < endRight) {
+                    nodes.push_back(right.get());
+                    inds.push_back(std::pair<int, int>(beginRight, endRight));
+                }
+                left->compactLeftCascade(lower, leftRank[begin], leftRank[end], nodes, inds);
+            }
+            else {
+                if (isLeaf) {
+                    return;
+                }
+                right->compactLeftCascade(lower, begin - leftRank[begin], end - leftRank[end], nodes, inds);
+            }
+        }
+
+        void compactRightCascade(const Point_d& upper,
+            int begin,
+            int end,
+            std::vector<RangeTreeNode<S>* >& nodes,
+            std::vector<std::pair<int, int> >& inds) {
+            if (begin >= end) {
+                return;
+            }
+
+            int compareInd = point->dim() - 2;
+
+            if ((*point)[compareInd] <= upper[compareInd]) {
+                if (isLeaf) {
+                    nodes.push_back(this);
+                    inds.push_back(std::pair<int, int>(0, 1));
+                    return;
+                }
+
+                int beginLeft = leftRank[begin];
+                int endLeft = leftRank[end];
+                if (beginLeft < endLeft) {
+                    nodes.push_back(left.get());
+                    inds.push_back(std::pair<int, int>(beginLeft, endLeft));
+                }
+                right->compactRightCascade(upper, begin - leftRank[begin], end - leftRank[end], nodes, inds);
+            }
+            else {
+                if (isLeaf) {
+                    return;
+                }
+                left->compactRightCascade(upper, leftRank[begin], leftRank[end], nodes, inds);
+            }
+        }
+
+        /**
+        * Approximate number of bytes used by the tree rooted at this node, excluding the points themselves.
+        */
+        size_t memoryUsage() const {
+            size_t bytes = sizeof(RangeTreeNode<S>) +
+                pointsLastDimSorted.capacity() * sizeof(NumTy) +
+                allPointsSorted.capacity() * sizeof(RTPoint<S>*) +
+                (pointerToGeqLeft.capacity() + pointerToLeqLeft.capacity() +
+                    pointerToGeqRight.capacity() + pointerToLeqRight.capacity() +
+                    cumuCountPoints.capacity()) * sizeof(int) +
+                leftRank.capacity() * sizeof(uint32_t);
+            if (!isLeaf) {
+                bytes += left->memoryUsage() + right->memoryUsage();
+            }
+            if (treeOnNextDim) {
+                bytes += treeOnNextDim->memoryUsage();
+            }
+            return bytes;
+        }
+
         /**
         * Helper function for countInRange(...).
         * @param lower
@@ -1100,8 +1501,11 @@ namespace RangeTree {
     */
     template <class S>
     class RangeTree {
+        friend class RangeTreeImage<S>;
+
     private:
         std::shared_ptr<RangeTreeNode<S> > root;
+        Storage storage;
         std::vector<std::shared_ptr<RTPoint<S> > > savedPoints;
         std::vector<RTPoint<S>* > savedPointsRaw;
 
@@ -1113,6 +1517,27 @@ namespace RangeTree {
             return vecOfPointers;
         }
 
+        /**
+        * As copyPointsToHeap(...), but releases the input as soon as it has been copied.
+        */
+        std::vector<std::shared_ptr<RTPoint<S> > > movePointsToHeap(std::vector<RTPoint<S> >& points) {
+            auto vecOfPointers = copyPointsToHeap(points);
+            std::vector<RTPoint<S> >().swap(points);
+            return vecOfPointers;
+        }
+
+        void build(unsigned int numThreads) {
+            if (numThreads == 0) {
+                numThreads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            int forkDepth = 0;
+            while ((1u << forkDepth) < numThreads) {
+                forkDepth++;
+            }
+            SortedPointMatrix<S> spm(savedPointsRaw);
+            root = std::shared_ptr<RangeTreeNode<S> >(new RangeTreeNode<S>(spm, true, true, forkDepth, storage));
+        }
+
         std::vector<RTPoint<S>* > getRawPointers(std::vector<std::shared_ptr<RTPoint<S> > >& points) {
             std::vector<RTPoint<S>* > vecOfPointers;
             for (int i = 0; i < points.size(); i++) {
@@ -1153,12 +1578,53 @@ namespace RangeTree {
         * then they are required to have the same value as all duplicate points will be accumulated into a
         * single point with multiplicity/count equal to the sum of the multiplicities/counts of all such duplicates.
         *
+        * Construction forks on the left and right subtrees of large nodes, so that up to \numThreads
+        * threads build the tree concurrently. The resulting tree does not depend on \numThreads.
+        *
         * @param points the points from which to create a RangeTree
+        * @param numThreads the maximum number of threads used for construction, 0 uses all hardware threads.
+        * @param storage how to store the fractional cascading arrays, see Storage.
         */
-        RangeTree(const std::vector<RTPoint<S> >& points) : savedPoints(copyPointsToHeap(points)),
-            savedPointsRaw(getRawPointers(savedPoints)) {
-            SortedPointMatrix<S> spm(savedPointsRaw);
-            root = std::shared_ptr<RangeTreeNode<S> >(new RangeTreeNode<S>(spm));
+        RangeTree(const std::vector<RTPoint<S> >& points, unsigned int numThreads = 0, Storage storage = Storage::Full) :
+            storage(storage), savedPoints(copyPointsToHeap(points)), savedPointsRaw(getRawPointers(savedPoints)) {
+            build(numThreads);
+        }
+
+        /**
+        * Construct a new RangeTree from input points that are no longer needed by the caller.
+        *
+        * The input is released once the tree has its own copies of the points, before the nodes are built,
+        * so it does not add to the peak memory of the construction.
+        *
+        * @param points the points from which to create a RangeTree, left empty.
+        * @param numThreads see RangeTree(const std::vector<RTPoint<S> >&, unsigned int, Storage).
+        * @param storage see RangeTree(const std::vector<RTPoint<S> >&, unsigned int, Storage).
+        */
+        RangeTree(std::vector<RTPoint<S> >&& points, unsigned int numThreads = 0, Storage storage = Storage::Full) :
+            storage(storage), savedPoints(movePointsToHeap(points)), savedPointsRaw(getRawPointers(savedPoints)) {
+            build(numThreads);
+        }
+
+        /**
+        * How the fractional cascading arrays of this tree are stored.
+        */
+        Storage getStorage() const {
+            return storage;
+        }
+
+        /**
+        * Approximate number of bytes used by the tree, including the copies of the input points.
+        *
+        * @return the number of bytes.
+        */
+        size_t memoryUsage() const {
+            size_t bytes = root->memoryUsage() +
+                savedPoints.capacity() * sizeof(std::shared_ptr<RTPoint<S> >) +
+                savedPointsRaw.capacity() * sizeof(RTPoint<S>*);
+            for (int i = 0; i < savedPoints.size(); i++) {
+                bytes += sizeof(RTPoint<S>) + savedPoints[i]->dim() * sizeof(NumTy);
+            }
+            return bytes;
         }
 
         /**
@@ -1218,6 +1684,33 @@ namespace RangeTree {
             return root->countInRange(lower, upper);
         }
 
+        /**
+        * The number of points within each of a batch of rectangles.
+        *
+        * Gives the same counts as calling countInRange(lower, upper) for every rectangle, but all
+        * rectangles descend the tree together so that every node is visited once per batch.
+        *
+        * @param lowers the lower bounds of the rectangles.
+        * @param uppers the upper bounds of the rectangles.
+        * @return the number of points in each rectangle.
+        */
+        std::vector<int> batchCountInRange(const std::vector<Point_d>& lowers,
+            const std::vector<Point_d>& uppers) const {
+            if (lowers.size() != uppers.size()) {
+                throw std::logic_error("batchCountInRange requires as many upper as lower bounds.");
+            }
+            std::vector<int> counts(lowers.size(), 0);
+            std::vector<int> queries;
+            for (int i = 0; i < lowers.size(); i++) {
+                if (lowers[i].dimension() != uppers[i].dimension()) {
+                    throw std::logic_error("upper and lower in batchCountInRange must have the same length.");
+                }
+                queries.push_back(i);
+            }
+            root->batchCountInRange(queries, lowers, uppers, counts);
+            return counts;
+        }
+
         /**
         * Return all points in range.
         *
@@ -0,0 +1,545 @@
+#pragma once
+/**
+ * Implements a serialized, memory-mapped image of a 2-dimensional RangeTree.
+ *
+ * A RangeTree is a pointer based structure that has to be rebuilt from its input points on every run.
+ * For static datasets this file provides the RangeTreeImage class, which stores the flattened tree
+ * (node array, fractional cascading arrays and point payloads) in a versioned binary file. Opening an
+ * image maps the file read-only into memory, so no parsing or allocation happens at load time and
+ * several processes querying the same image share its pages.
+ */
+
+#ifndef RANGETREE_IMAGE_H
+#define RANGETREE_IMAGE_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+#include <unordered_map>
+#include <type_traits>
+#include "rangetree.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace RangeTree {
+
+    /**
+    * A read-only, memory-mapped image of a 2-dimensional RangeTree.
+    *
+    * Images are written once from a constructed RangeTree using RangeTreeImage::write(...) and can
+    * then be opened any number of times. Queries give exactly the same results as the RangeTree the
+    * image was written from. Only trees on 2-dimensional points whose values are trivially copyable
+    * can be stored.
+    */
+    template <class S>
+    class RangeTreeImage {
+    private:
+        static const uint32_t MAGIC = 0x4d495452; /**< "RTIM" **/
+        static const uint32_t VERSION = 1;
+
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t dim;
+            uint32_t valueSize;
+            uint64_t numNodes;
+            uint64_t numPoints;
+            uint64_t numCascade; /**< Total length of all pointsLastDimSorted arrays of internal nodes **/
+            uint64_t numCumu; /**< Total length of all cumuCountPoints arrays of internal nodes **/
+            uint64_t coordsOffset;
+            uint64_t lastDimOffset;
+            uint64_t nodesOffset;
+            uint64_t countsOffset;
+            uint64_t allPointsOffset;
+            uint64_t geqLeftOffset;
+            uint64_t leqLeftOffset;
+            uint64_t geqRightOffset;
+            uint64_t leqRightOffset;
+            uint64_t cumuOffset;
+            uint64_t valuesOffset;
+            uint64_t fileSize;
+        };
+
+        struct Node {
+            int32_t left; /**< Index of the left child, -1 for leaves **/
+            int32_t right; /**< Index of the right child, -1 for leaves **/
+            int32_t point; /**< Index of the comparison point **/
+            int32_t pointCountSum;
+            int32_t cascadeBegin; /**< Offset into the cascade arrays, -1 for leaves **/
+            int32_t cascadeSize;
+            int32_t cumuBegin; /**< Offset into the cumulative count array, -1 for leaves **/
+            int32_t padding;
+        };
+
+        static_assert(std::is_trivially_copyable<S>::value, "Range tree images require trivially copyable values.");
+        static_assert(alignof(S) <= 8, "Range tree images require values aligned to at most 8 bytes.");
+
+        const char* data;
+        size_t size;
+#ifdef _WIN32
+        HANDLE fileHandle;
+        HANDLE mappingHandle;
+#else
+        int fd;
+#endif
+
+        const Header* header;
+        const NumTy* coords;
+        const NumTy* lastDim;
+        const Node* nodes;
+        const int32_t* counts;
+        const int32_t* allPoints;
+        const int32_t* geqLeft;
+        const int32_t* leqLeft;
+        const int32_t* geqRight;
+        const int32_t* leqRight;
+        const int32_t* cumu;
+        const S* values;
+
+        static uint64_t align(uint64_t offset) {
+            return (offset + 7) & ~(uint64_t)7;
+        }
+
+        static int32_t flatten(const RangeTreeNode<S>* node,
+            const std::unordered_map<const RTPoint<S>*, int32_t>& pointIndex,
+            std::vector<Node>& nodes,
+            std::vector<NumTy>& lastDim,
+            std::vector<int32_t>& allPoints,
+            std::vector<int32_t>& geqLeft,
+            std::vector<int32_t>& leqLeft,
+            std::vector<int32_t>& geqRight,
+            std::vector<int32_t>& leqRight,
+            std::vector<int32_t>& cumu) {
+            int32_t index = nodes.size();
+            nodes.push_back(Node());
+            Node flat = { -1, -1, pointIndex.at(node->point), node->pointCountSum, -1, 0, -1, 0 };
+
+            if (!node->isLeaf) {
+                flat.cascadeBegin = lastDim.size();
+                flat.cascadeSize = node->pointsLastDimSorted.size();
+                flat.cumuBegin = cumu.size();
+                lastDim.insert(lastDim.end(), node->pointsLastDimSorted.begin(), node->pointsLastDimSorted.end());
+                for (int i = 0; i < node->allPointsSorted.size(); i++) {
+                    allPoints.push_back(pointIndex.at(node->allPointsSorted[i]));
+                }
+                geqLeft.insert(geqLeft.end(), node->pointerToGeqLeft.begin(), node->pointerToGeqLeft.end());
+                leqLeft.insert(leqLeft.end(), node->pointerToLeqLeft.begin(), node->pointerToLeqLeft.end());
+                geqRight.insert(geqRight.end(), node->pointerToGeqRight.begin(), node->pointerToGeqRight.end());
+                leqRight.insert(leqRight.end(), node->pointerToLeqRight.begin(), node->pointerToLeqRight.end());
+                cumu.insert(cumu.end(), node->cumuCountPoints.begin(), node->cumuCountPoints.end());
+
+                flat.left = flatten(node->left.get(), pointIndex, nodes, lastDim, allPoints,
+                    geqLeft, leqLeft, geqRight, leqRight, cumu);
+                flat.right = flatten(node->right.get(), pointIndex, nodes, lastDim, allPoints,
+                    geqLeft, leqLeft, geqRight, leqRight, cumu);
+            }
+            nodes[index] = flat;
+            return index;
+        }
+
+        template <class T>
+        static void writeSection(std::ofstream& out, const std::vector<T>& section, uint64_t offset) {
+            out.seekp(offset);
+            if (!section.empty()) {
+                out.write(reinterpret_cast<const char*>(section.data()), section.size() * sizeof(T));
+            }
+        }
+
+        template <class T>
+        const T* section(uint64_t offset) const {
+            return reinterpret_cast<const T*>(data + offset);
+        }
+
+        NumTy coord(int32_t point, int index) const {
+            return coords[(size_t)point * 2 + index];
+        }
+
+        bool pointInRange(int32_t point, const Point_d& lower, const Point_d& upper) const {
+            for (int i = 0; i < 2; i++) {
+                if (coord(point, i) < lower[i] || coord(point, i) > upper[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        RTPoint<S> getPoint(int32_t point) const {
+            RTPoint<S> p(Point_d(std::vector<NumTy>(coords + (size_t)point * 2, coords + (size_t)point * 2 + 2)), values[point]);
+            p.increaseCountBy(counts[point] - 1);
+            return p;
+        }
+
+        /**
+        * Finds the split node of the query and the cascade indices of the query's last dimension in it.
+        *
+        * @return the index of the split node, or -1 if the query was fully answered by a leaf (in
+        *         which case \leaf holds that leaf, or -1 if no leaf lies in range).
+        */
+        int32_t findSplitNode(const Point_d& lower, const Point_d& upper, int32_t& leaf, int& geqInd, int& leqInd) const {
+            int32_t v = 0;
+            leaf = -1;
+            while (true) {
+                const Node& node = nodes[v];
+                if (node.left == -1) {
+                    if (pointInRange(node.point, lower, upper)) {
+                        leaf = v;
+                    }
+                    return -1;
+                }
+                NumTy c = coord(node.point, 0);
+                if (c > upper[0]) {
+                    v = node.left;
+                }
+                else if (c < lower[0]) {
+                    v = node.right;
+                }
+                else {
+                    break;
+                }
+            }
+
+            const Node& node = nodes[v];
+            const NumTy* begin = lastDim + node.cascadeBegin;
+            const NumTy* end = begin + node.cascadeSize;
+            geqInd = std::lower_bound(begin, end, lower[1]) - begin;
+            leqInd = (std::upper_bound(begin, end, upper[1]) - begin) - 1;
+            return v;
+        }
+
+        /**
+        * Collects the canonical (node, first index, last index) triples for a query, see
+        * RangeTreeNode::leftFractionalCascade(...) and RangeTreeNode::rightFractionalCascade(...).
+        */
+        template <class F>
+        void fractionalCascade(const Point_d& lower, const Point_d& upper,
+            int32_t split, int geqInd, int leqInd, F onCanonical) const {
+            const Node& splitNode = nodes[split];
+
+            int32_t v = splitNode.left;
+            int geq = geqLeft[splitNode.cascadeBegin + geqInd];
+            int leq = leqLeft[splitNode.cascadeBegin + leqInd];
+            while (leq >= geq) {
+                const Node& node = nodes[v];
+                if (lower[0] <= coord(node.point, 0)) {
+                    if (node.left == -1) {
+                        onCanonical(v, 0, 0);
+                        break;
+                    }
+                    int geqRightInd = geqRight[node.cascadeBegin + geq];
+                    int leqRightInd = leqRight[node.cascadeBegin + leq];
+                    if (leqRightInd >= geqRightInd) {
+                        onCanonical(node.right, geqRightInd, leqRightInd);
+                    }
+                    geq = geqLeft[node.cascadeBegin + geq];
+                    leq = leqLeft[node.cascadeBegin + leq];
+                    v = node.left;
+                }
+                else {
+                    if (node.left == -1) {
+                        break;
+                    }
+                    geq = geqRight[node.cascadeBegin + geq];
+                    leq = leqRight[node.cascadeBegin + leq];
+                    v = node.right;
+                }
+            }
+
+            v = splitNode.right;
+            geq = geqRight[splitNode.cascadeBegin + geqInd];
+            leq = leqRight[splitNode.cascadeBegin + leqInd];
+            while (leq >= geq) {
+                const Node& node = nodes[v];
+                if (coord(node.point, 0) <= upper[0]) {
+                    if (node.left == -1) {
+                        onCanonical(v, 0, 0);
+                        break;
+                    }
+                    int geqLeftInd = geqLeft[node.cascadeBegin + geq];
+                    int leqLeftInd = leqLeft[node.cascadeBegin + leq];
+                    if (leqLeftInd >= geqLeftInd) {
+                        onCanonical(node.left, geqLeftInd, leqLeftInd);
+                    }
+                    geq = geqRight[node.cascadeBegin + geq];
+                    leq = leqRight[node.cascadeBegin + leq];
+                    v = node.right;
+                }
+                else {
+                    if (node.left == -1) {
+                        break;
+                    }
+                    geq = geqLeft[node.cascadeBegin + geq];
+                    leq = leqLeft[node.cascadeBegin + leq];
+                    v = node.left;
+                }
+            }
+        }
+
+        void unmap() {
+#ifdef _WIN32
+            if (data) UnmapViewOfFile(data);
+            if (mappingHandle) CloseHandle(mappingHandle);
+            if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+#else
+            if (data) munmap(const_cast<char*>(data), size);
+            if (fd >= 0) close(fd);
+#endif
+            data = nullptr;
+        }
+
+    public:
+        /**
+        * Writes the image of a range tree to disk.
+        *
+        * @param tree a range tree on 2-dimensional points with Storage::Full.
+        * @param filename the file to write the image to, it is overwritten if it exists.
+        */
+        static void write(const RangeTree<S>& tree, const std::string& filename) {
+            const std::vector<RTPoint<S>* >& points = tree.savedPointsRaw;
+            if (points.empty() || points[0]->dim() != 2) {
+                throw std::logic_error("Range tree images are only supported for 2-dimensional trees.");
+            }
+            if (tree.getStorage() != Storage::Full) {
+                throw std::logic_error("Range tree images can only be written from trees with full storage.");
+            }
+
+            std::unordered_map<const RTPoint<S>*, int32_t> pointIndex;
+            std::vector<NumTy> coords;
+            std::vector<int32_t> counts;
+            std::vector<S> values;
+            for (int i = 0; i < points.size(); i++) {
+                pointIndex[points[i]] = i;
+                coords.push_back((*points[i])[0]);
+                coords.push_back((*points[i])[1]);
+                counts.push_back(points[i]->count());
+                values.push_back(points[i]->value());
+            }
+
+            std::vector<Node> nodes;
+            std::vector<NumTy> lastDim;
+            std::vector<int32_t> allPoints, geqLeft, leqLeft, geqRight, leqRight, cumu;
+            flatten(tree.root.get(), pointIndex, nodes, lastDim, allPoints,
+                geqLeft, leqLeft, geqRight, leqRight, cumu);
+
+            Header header = {};
+            header.magic = MAGIC;
+            header.version = VERSION;
+            header.dim = 2;
+            header.valueSize = sizeof(S);
+            header.numNodes = nodes.size();
+            header.numPoints = points.size();
+            header.numCascade = lastDim.size();
+            header.numCumu = cumu.size();
+            header.coordsOffset = align(sizeof(Header));
+            header.lastDimOffset = align(header.coordsOffset + coords.size() * sizeof(NumTy));
+            header.nodesOffset = align(header.lastDimOffset + lastDim.size() * sizeof(NumTy));
+            header.countsOffset = align(header.nodesOffset + nodes.size() * sizeof(Node));
+            header.allPointsOffset = align(header.countsOffset + counts.size() * sizeof(int32_t));
+            header.geqLeftOffset = align(header.allPointsOffset + allPoints.size() * sizeof(int32_t));
+            header.leqLeftOffset = align(header.geqLeftOffset + geqLeft.size() * sizeof(int32_t));
+            header.geqRightOffset = align(header.leqLeftOffset + leqLeft.size() * sizeof(int32_t));
+            header.leqRightOffset = align(header.geqRightOffset + geqRight.size() * sizeof(int32_t));
+            header.cumuOffset = align(header.leqRightOffset + leqRight.size() * sizeof(int32_t));
+            header.valuesOffset = align(header.cumuOffset + cumu.size() * sizeof(int32_t));
+            header.fileSize = align(header.valuesOffset + values.size() * sizeof(S));
+
+            std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                throw std::runtime_error("Could not open " + filename + " for writing.");
+            }
+            out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+            writeSection(out, coords, header.coordsOffset);
+            writeSection(out, lastDim, header.lastDimOffset);
+            writeSection(out, nodes, header.nodesOffset);
+            writeSection(out, counts, header.countsOffset);
+            writeSection(out, allPoints, header.allPointsOffset);
+            writeSection(out, geqLeft, header.geqLeftOffset);
+            writeSection(out, leqLeft, header.leqLeftOffset);
+            writeSection(out, geqRight, header.geqRightOffset);
+            writeSection(out, leqRight, header.leqRightOffset);
+            writeSection(out, cumu, header.cumuOffset);
+            writeSection(out, values, header.valuesOffset);
+            // pad the file to its full size so that the final section can be mapped
+            out.seekp(header.fileSize - 1);
+            out.put(0);
+            if (!out) {
+                throw std::runtime_error("Could not write range tree image " + filename + ".");
+            }
+        }
+
+        /**
+        * Opens a range tree image by mapping it into memory.
+        *
+        * @param filename an image written by RangeTreeImage::write(...).
+        */
+        RangeTreeImage(const std::string& filename) : data(nullptr), size(0) {
+#ifdef _WIN32
+            mappingHandle = nullptr;
+            fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            LARGE_INTEGER fileSize;
+            if (fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(fileHandle, &fileSize)) {
+                unmap();
+                throw std::runtime_error("Could not open range tree image " + filename + ".");
+            }
+            size = (size_t)fileSize.QuadPart;
+            mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mappingHandle) {
+                data = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+            }
+#else
+            fd = open(filename.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0) {
+                unmap();
+                throw std::runtime_error("Could not open range tree image " + filename + ".");
+            }
+            size = st.st_size;
+            if (size > 0) {
+                void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+                data = mapped == MAP_FAILED ? nullptr : static_cast<const char*>(mapped);
+            }
+#endif
+            if (!data) {
+                unmap();
+                throw std::runtime_error("Could not map range tree image " + filename + ".");
+            }
+
+            header = section<Header>(0);
+            if (size < sizeof(Header) || header->magic != MAGIC) {
+                unmap();
+                throw std::runtime_error(filename + " is not a range tree image.");
+            }
+            if (header->version != VERSION || header->dim != 2 || header->valueSize != sizeof(S) ||
+                header->fileSize != size || header->numNodes == 0) {
+                unmap();
+                throw std::runtime_error("Range tree image " + filename + " is incompatible with this build.");
+            }
+
+            coords = section<NumTy>(header->coordsOffset);
+            lastDim = section<NumTy>(header->lastDimOffset);
+            nodes = section<Node>(header->nodesOffset);
+            counts = section<int32_t>(header->countsOffset);
+            allPoints = section<int32_t>(header->allPointsOffset);
+            geqLeft = section<int32_t>(header->geqLeftOffset);
+            leqLeft = section<int32_t>(header->leqLeftOffset);
+            geqRight = section<int32_t>(header->geqRightOffset);
+            leqRight = section<int32_t>(header->leqRightOffset);
+            cumu = section<int32_t>(header->cumuOffset);
+            values = section<S>(header->valuesOffset);
+        }
+
+        RangeTreeImage(const RangeTreeImage<S>&) = delete;
+        RangeTreeImage<S>& operator=(const RangeTreeImage<S>&) = delete;
+
+        ~RangeTreeImage() {
+            unmap();
+        }
+
+        /**
+        * The number of points within a rectangle, see RangeTree::countInRange(...).
+        *
+        * @param lower the lower bounds of the rectangle.
+        * @param upper the upper bounds of the rectangle.
+        * @return the number of points in the rectangle, number of binary searches to get there.
+        */
+        std::pair<int, int> countInRange(const Point_d& lower,
+            const Point_d& upper) const {
+            if (lower.dimension() != 2 || upper.dimension() != 2) {
+                throw std::logic_error("upper and lower in countInRange must be 2-dimensional.");
+            }
+            int32_t leaf;
+            int geqInd = 0, leqInd = -1;
+            int32_t split = findSplitNode(lower, upper, leaf, geqInd, leqInd);
+            if (split == -1) {
+                return std::pair<int, int>(leaf == -1 ? 0 : nodes[leaf].pointCountSum, 0);
+            }
+            if (geqInd > leqInd) {
+                return std::pair<int, int>(0, 0);
+            }
+
+            int sum = 0;
+            fractionalCascade(lower, upper, split, geqInd, leqInd, [this, &sum](int32_t v, int first, int last) {
+                const Node& node = nodes[v];
+                if (node.left == -1) {
+                    sum += node.pointCountSum;
+                }
+                else {
+                    sum += cumu[node.cumuBegin + last + 1] - cumu[node.cumuBegin + first];
+                }
+            });
+            return std::pair<int, int>(sum, 2);
+        }
+
+        /**
+        * Return all points in range, see RangeTree::pointsInRange(...).
+        *
+        * @param lower the lower bounds of the rectangle.
+        * @param upper the upper bounds of the rectangle.
+        * @return a std::vector of the Points.
+        */
+        std::vector<RTPoint<S> > pointsInRange(const Point_d& lower,
+            const Point_d& upper) const {
+            if (lower.dimension() != 2 || upper.dimension() != 2) {
+                throw std::logic_error("upper and lower in pointsInRange must be 2-dimensional.");
+            }
+            std::vector<RTPoint<S> > pointsToReturn = {};
+            if (lower[0] > upper[0] || lower[1] > upper[1]) {
+                return pointsToReturn;
+            }
+            int32_t leaf;
+            int geqInd = 0, leqInd = -1;
+            int32_t split = findSplitNode(lower, upper, leaf, geqInd, leqInd);
+            if (split == -1) {
+                if (leaf != -1) {
+                    pointsToReturn.push_back(getPoint(nodes[leaf].point));
+                }
+                return pointsToReturn;
+            }
+            if (geqInd > leqInd) {
+                return pointsToReturn;
+            }
+
+            fractionalCascade(lower, upper, split, geqInd, leqInd, [this, &pointsToReturn](int32_t v, int first, int last) {
+                const Node& node = nodes[v];
+                if (node.left == -1) {
+                    pointsToReturn.push_back(getPoint(node.point));
+                }
+                else {
+                    for (int j = first; j <= last; j++) {
+                        pointsToReturn.push_back(getPoint(allPoints[node.cascadeBegin + j]));
+                    }
+                }
+            });
+            return pointsToReturn;
+        }
+
+        /**
+        * The number of unique points stored in the image.
+        */
+        size_t numUniquePoints() const {
+            return header->numPoints;
+        }
+
+        /**
+        * The size of the mapped image in bytes.
+        */
+        size_t imageSize() const {
+            return size;
+        }
+    };
+
+} // namespace
+
+#endif //RANGETREE_IMAGE_H
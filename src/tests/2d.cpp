@@ -8,7 +8,17 @@
 #include <CGAL/constructions_d.h>
 #include <fstream>
 #include "../2D/range_query.cpp"
+#include "../2D/engine.cpp"
+#include "../2D/rangetree_image.h"
+#include "../2D/dynamic_rangetree.h"
 #include "../2D/mode_query.cpp";
+#include "../2D/cutting_tree.cpp"
+#include "../2D/point_location.cpp"
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
 namespace N2D {
 	typedef pair<pair<Point_d, Color>, int> gamma_triple;
@@ -46,6 +56,27 @@ namespace N2D {
 		return points;
 	}
 
+	// Reads a points file straight into the columns of a point store, without intermediate Point_d's
+	static PointStore read_point_store(string filename) {
+		string text;
+		vec<NumTy> xs = {}, ys = {};
+		vec<Color> colors = {};
+
+		ifstream file(filename);
+
+		while (getline(file, text)) {
+			vec<string> args = split(text);
+
+			xs.push_back(stod(args[0]));
+			ys.push_back(stod(args[1]));
+			colors.push_back((Color)stoi(args[args.size() - 1]));
+		}
+
+		file.close();
+
+		return generate_point_store(std::move(xs), std::move(ys), std::move(colors));
+	}
+
 	static vec<Point_d> generate_locations(NumTy min, NumTy max, int count) {
 		vec<Point_d> positions(count);
 
@@ -117,24 +148,60 @@ namespace N2D {
 	// As the range tree implementation is already pretty simple, the only thing naiver than this that I could come 
 	// up with is the O(n log n) sorting of all points and then taking the kth element
 	static NumTy naive_range(vec<Point_d>* locations, Point_d q, int k) {
-		vec<NumTy> distances(locations->size());
+		vec<NumTy> distances(locations->size(), 0);
 		for (int i = 0; i < distances.size(); i++) {
-			auto dx = abs((*locations)[i].x() - q.x());
-			auto dy = abs((*locations)[i].y() - q.y());
-			distances[i] = max(dx, dy);
+			for (int dim = 0; dim < q.dimension(); dim++) {
+				distances[i] = max(distances[i], abs((*locations)[i][dim] - q[dim]));
+			}
 		}
 		sort(distances.begin(), distances.end());
 		return distances[k];
 	}
 
+	// Returns the dual query points of lines through the query points, with random slopes the arrangement supports.
+	// The slopes stay within MAX_QUERY_SLOPE, since get_dual_query rejects steeper lines.
+	static vec<Point_2> get_dual_queries(DualTransform* transform, vec<Point_d>* query_points) {
+		uniform_real_distribution<NumTy> rnd_slope(-MAX_QUERY_SLOPE, MAX_QUERY_SLOPE);
+		default_random_engine re(chrono::system_clock::now().time_since_epoch().count());
+
+		vec<Point_2> dual_queries = {};
+		for (auto& q : *query_points) {
+			NumTy slope = rnd_slope(re);
+			dual_queries.push_back(get_dual_query(transform, slope, q.y() - slope * q.x()));
+		}
+		return dual_queries;
+	}
+
+	// The temperature files the mode query runners work on
+	static vec<string> get_mode_benchmark_files() {
+		string rel_dir = "..\\data\\temperature\\";
+		return {
+			rel_dir + "temperature-03-06-2024.points",
+			rel_dir + "temperature-04-06-2024.points",
+		};
+	}
+
+	// Returns Q random points of the store, lines through them make queries with answers spread over the data
+	static vec<Point_d> get_primal_query_points(PointStore* store, int Q) {
+		default_random_engine re(chrono::system_clock::now().time_since_epoch().count());
+		uniform_int_distribution<int> rnd_index(0, store->xs.size() - 1);
+
+		vec<Point_d> primal_points = {};
+		for (int j = 0; j < Q; j++) {
+			int index = rnd_index(re);
+			primal_points.push_back(Point_d({ store->xs[index], store->ys[index] }));
+		}
+		return primal_points;
+	}
+
 	// Get mode by querying the radius using a range tree.
 	// O(log n + k) complexity.
-	static pair<Color, int> naive_mode(Tree rt, Point_d q, NumTy r) {
+	static pair<Color, int> naive_mode(Tree rt, vec<Color>* colors, Point_d q, NumTy r) {
 		Point_d lower({ q.x() - r, q.y() - r }), upper({ q.x() + r, q.y() + r });
 		auto points = rt->pointsInRange(lower, upper);
 		map<Color, int> candidate_modes;
 		for (auto point : points) {
-			auto color = point.value();
+			auto color = (*colors)[point.value()];
 			if (candidate_modes.count(color)) candidate_modes[color]++;
 			else candidate_modes[color] = 1;
 		}
@@ -170,30 +237,32 @@ namespace N2D {
 
 			// generate dataset
 			
-			auto locations = (*pre_gen_points)[run_num - 1];
-			auto colors = (*pre_gen_colors)[run_num - 1];
+			auto& locations = (*pre_gen_points)[run_num - 1];
+			auto& colors = (*pre_gen_colors)[run_num - 1];
 			vec<NumTy> radii = {};
 
 			// generate tree
-			auto tree = generate_tree(&locations, &colors);
-			auto sorted_x_pairs = generate_sorted_dim_pairs(&locations, 0);
-			auto sorted_y_pairs = generate_sorted_dim_pairs(&locations, 1);
-			auto sorted_x_values = get_sorted_dim_values(&sorted_x_pairs);
-			auto sorted_y_values = get_sorted_dim_values(&sorted_y_pairs);
+			auto store = generate_point_store(&locations, &colors);
+			auto tree = generate_tree(&store);
+			auto duplicates = generate_duplicate_ids(&store);
 
 			// TODO: fix st entire rectangle can be queried
 			auto query_points = generate_locations(
-				max(sorted_x_values[1], sorted_y_values[1]),
-				min(sorted_x_values[sorted_x_values.size() - 2], sorted_y_values[sorted_y_values.size() - 2]),
+				max(store.sorted_x[1], store.sorted_y[1]),
+				min(store.sorted_x[store.sorted_x.size() - 2], store.sorted_y[store.sorted_y.size() - 2]),
 				Q
 			);
 			auto gen_tree_end = chrono::high_resolution_clock::now();
 
 			// perform range queries using quick method
+			Instrumentation::reset();
 			for (int i = 0; i < Q; i++) {
-				auto res = N2D::query_k_nearest(&tree, &sorted_x_values, &sorted_y_values, query_points[i], k); // distance not used for now
+				auto res = N2D::query_k_nearest_mode(&tree, &store.sorted_x, &store.sorted_y, &duplicates, &store.colors, query_points[i], k);
 			}
 			auto range_tree_end = chrono::high_resolution_clock::now();
+#ifdef INSTRUMENT_2D
+			Instrumentation::print(cerr);
+#endif
 
 			// perform range queries using naive method
 			for (int i = 0; i < Q; i++) {
@@ -201,24 +270,25 @@ namespace N2D {
 			}
 			auto range_naive_end = chrono::high_resolution_clock::now();
 
-			vec<Point_2> mode_points = convert_point_d_to_point_2(&locations);
-			ModeData md = preprocess_mode(&mode_points, &colors, r);
+			Instrumentation::reset();
+			ModeData md = preprocess_mode(&store.xs, &store.ys, &store.colors, r);
+#ifdef INSTRUMENT_2D
+			Instrumentation::print(cerr);
+#endif
+			if (!md.valid) cerr << "No valid " << r << "-cutting found, the largest conflict list has " << get_max_conflicts(&md.cl) << " lines." << endl;
 			Trapezoid_pl tpl(md.arr);
-			uniform_real_distribution<NumTy> rnd_pos(md.lower.x(), md.upper.x());
-			default_random_engine re(chrono::system_clock::now().time_since_epoch().count());
+			auto dual_queries = get_dual_queries(&md.transform, &query_points);
 			auto gen_mode_end = chrono::high_resolution_clock::now();
 
 			// perform mode queries using quick method
 			for (int i = 0; i < Q; i++) {
-				// TODO: replace with actual dual
-				Point_2 query(rnd_pos(re), rnd_pos(re));
-				query_arrangement(&md, &tpl, &colors, query);
+				query_arrangement(&md, &tpl, &store.colors, dual_queries[i]);
 			}
 			auto fast_mode_end = chrono::high_resolution_clock::now();
 
 			// perform mode queries using naive method
 			for (int i = 0; i < Q; i++) {
-				naive_mode(&tree, query_points[i], radii[i]);
+				naive_mode(&tree, &store.colors, query_points[i], radii[i]);
 			}
 			auto naive_mode_end = chrono::high_resolution_clock::now();
 
@@ -329,6 +399,844 @@ namespace N2D {
 		}
 	}
 
+	// Peak resident memory of the process so far, in bytes
+	static size_t get_peak_memory() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+		return counters.PeakWorkingSetSize;
+#else
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return (size_t)usage.ru_maxrss * 1024; // in kilobytes on Linux
+#endif
+	}
+
+	// Loads a points file and builds the range tree from a point store, against reading Point_d's and building from
+	// those. Reports the load times in microseconds and the peak memory of the process after each in megabytes.
+	// The peak only grows, so the store path runs first and the files go by increasing size.
+	static void run_2d_load() {
+		string rel_dir = "..\\data\\osm\\";
+		vec<string> files = { "bieleveld.points", "bbg.points", "1.points" };
+
+		for (int i = 0; i < files.size(); i++) {
+			long store_time, point_time;
+			size_t store_peak, point_peak;
+			{
+				auto store_start = chrono::high_resolution_clock::now();
+				auto store = read_point_store(rel_dir + files[i]);
+				auto tree = generate_tree(&store);
+				auto store_end = chrono::high_resolution_clock::now();
+				store_time = chrono::duration_cast<chrono::microseconds>(store_end - store_start).count();
+				store_peak = get_peak_memory();
+			}
+			{
+				auto point_start = chrono::high_resolution_clock::now();
+				auto data = read_file(rel_dir + files[i]);
+				vec<Point_d> locations = {};
+				vec<Color> colors = {};
+				for (auto& point : data) {
+					locations.push_back(point.first);
+					colors.push_back(point.second);
+				}
+				auto tree = generate_tree(&locations, &colors);
+				auto point_end = chrono::high_resolution_clock::now();
+				point_time = chrono::duration_cast<chrono::microseconds>(point_end - point_start).count();
+				point_peak = get_peak_memory();
+			}
+
+			cout << defaultfloat;
+			cout
+				<< "2D-LOAD-" << files[i] << " & "
+				<< store_time << " & "
+				<< point_time << " & "
+				<< fixed << setprecision(1) << store_peak / 1048576.0 << " & "
+				<< point_peak / 1048576.0 << " \\\\" << endl;
+		}
+	}
+
+	// Compares range tree construction time for an increasing number of build threads
+	static void run_2d_build() {
+		int num_runs = 3;
+		string rel_dir = "..\\data\\osm\\";
+		vec<string> files = { "bieleveld.points", "bbg.points", "1.points" };
+		vec<unsigned int> thread_counts = { 1, 2, 4, 8, 16 };
+
+		for (int i = 0; i < files.size(); i++) {
+			auto data = read_file(rel_dir + files[i]);
+			vec<RangeTree::RTPoint<Color>> points = {};
+			for (int j = 0; j < data.size(); j++) {
+				points.push_back(RangeTree::RTPoint<Color>(data[j].first, data[j].second));
+			}
+
+			cout << defaultfloat;
+			cout << "2D-BUILD-" << files[i] << "-" << points.size();
+			for (int t = 0; t < thread_counts.size(); t++) {
+				vec<long> build_times = {};
+				for (int run_num = 0; run_num < num_runs; run_num++) {
+					auto build_start = chrono::high_resolution_clock::now();
+					RangeTree::RangeTree<Color> tree(points, thread_counts[t]);
+					auto build_end = chrono::high_resolution_clock::now();
+					build_times.push_back(chrono::duration_cast<chrono::microseconds>(build_end - build_start).count());
+				}
+				auto avg_build = ((long)(accumulate(build_times.begin(), build_times.end(), 0l) / num_runs / 100.0)) / 10.0;
+				cout << fixed << setprecision(1) << " & " << avg_build;
+			}
+			cout << " \\\\" << endl;
+		}
+	}
+
+	// Compares a cold start from a memory-mapped range tree image against reading and rebuilding the tree
+	static void run_2d_image() {
+		int Q = 1000;
+		string rel_dir = "..\\data\\";
+		vec<string> files = { "osm\\bieleveld.points", "osm\\1.points", "temperature\\temperature-02-06-2024.points" };
+
+		for (int i = 0; i < files.size(); i++) {
+			// rebuild from the text file
+			auto rebuild_start = chrono::high_resolution_clock::now();
+			auto data = read_file(rel_dir + files[i]);
+			vec<Point_d> locations = {};
+			vec<Color> colors = {};
+			for (int j = 0; j < data.size(); j++) {
+				locations.push_back(data[j].first);
+				colors.push_back(data[j].second);
+			}
+			auto tree = generate_tree(&locations, &colors);
+			auto rebuild_end = chrono::high_resolution_clock::now();
+
+			string image_file = files[i].substr(files[i].find_last_of('\\') + 1) + ".rti";
+			RangeTree::RangeTreeImage<Color>::write(tree, image_file);
+
+			// cold start from the image
+			auto open_start = chrono::high_resolution_clock::now();
+			RangeTree::RangeTreeImage<Color> image(image_file);
+			auto open_end = chrono::high_resolution_clock::now();
+
+			auto sorted_x_pairs = generate_sorted_dim_pairs(&locations, 0);
+			auto sorted_y_pairs = generate_sorted_dim_pairs(&locations, 1);
+			auto sorted_x_values = get_sorted_dim_values(&sorted_x_pairs);
+			auto sorted_y_values = get_sorted_dim_values(&sorted_y_pairs);
+			auto query_points = generate_locations(
+				max(sorted_x_values[1], sorted_y_values[1]),
+				min(sorted_x_values[sorted_x_values.size() - 2], sorted_y_values[sorted_y_values.size() - 2]),
+				Q
+			);
+			NumTy side = (sorted_x_values[sorted_x_values.size() - 2] - sorted_x_values[1]) / 100;
+
+			auto tree_query_start = chrono::high_resolution_clock::now();
+			long tree_count = 0;
+			for (int j = 0; j < Q; j++) {
+				Point_d lower({ query_points[j].x() - side, query_points[j].y() - side });
+				Point_d upper({ query_points[j].x() + side, query_points[j].y() + side });
+				tree_count += tree.countInRange(lower, upper).first;
+			}
+			auto image_query_start = chrono::high_resolution_clock::now();
+			long image_count = 0;
+			for (int j = 0; j < Q; j++) {
+				Point_d lower({ query_points[j].x() - side, query_points[j].y() - side });
+				Point_d upper({ query_points[j].x() + side, query_points[j].y() + side });
+				image_count += image.countInRange(lower, upper).first;
+			}
+			auto image_query_end = chrono::high_resolution_clock::now();
+
+			if (tree_count != image_count) {
+				cout << "Range tree image of " << files[i] << " does not match the rebuilt tree." << endl;
+			}
+
+			cout << defaultfloat;
+			cout
+				<< "2D-IMAGE-" << files[i] << "-" << locations.size() << " & "
+				<< (image.imageSize() >> 20) << " MiB & "
+				<< chrono::duration_cast<chrono::microseconds>(rebuild_end - rebuild_start).count() << " & "
+				<< chrono::duration_cast<chrono::microseconds>(open_end - open_start).count() << " & "
+				<< chrono::duration_cast<chrono::microseconds>(image_query_start - tree_query_start).count() << " & "
+				<< chrono::duration_cast<chrono::microseconds>(image_query_end - image_query_start).count() << " & "
+				<< "\\\\" << endl;
+		}
+	}
+
+	// Reports the memory used per point by the range tree for each cascade storage mode on the OSM tiles
+	static void run_2d_memory() {
+		string rel_dir = "..\\data\\osm\\";
+		vec<string> files = { "1.points", "2.points", "3.points", "4.points", "5.points", "6.points", "7.points", "8.points", "9.points", "10.points" };
+		vec<RangeTree::Storage> storages = { RangeTree::Storage::Full, RangeTree::Storage::Compact, RangeTree::Storage::CountOnly };
+
+		for (int i = 0; i < files.size(); i++) {
+			auto data = read_file(rel_dir + files[i]);
+			vec<RangeTree::RTPoint<Color>> points = {};
+			for (int j = 0; j < data.size(); j++) {
+				points.push_back(RangeTree::RTPoint<Color>(data[j].first, data[j].second));
+			}
+
+			cout << defaultfloat;
+			cout << "2D-MEM-" << files[i] << "-" << points.size();
+			for (int j = 0; j < storages.size(); j++) {
+				RangeTree::RangeTree<Color> tree(points, 0, storages[j]);
+				cout << fixed << setprecision(1) << " & " << (double)tree.memoryUsage() / points.size();
+			}
+			cout << " \\\\" << endl;
+		}
+	}
+
+	// Compares counting Q random squares one at a time against a single batched count
+	static void run_2d_batch_count() {
+		vec<int> Ns = { 10000, 100000 };
+		vec<int> Qs = { 100, 1000, 10000, 100000 };
+		NumTy min = 0, max = 1000;
+
+		for (int i_n = 0; i_n < Ns.size(); i_n++) {
+			auto locations = generate_locations(min, max, Ns[i_n]);
+			vec<Color> colors(Ns[i_n], 0);
+			auto tree = generate_tree(&locations, &colors);
+
+			for (int i_q = 0; i_q < Qs.size(); i_q++) {
+				auto centers = generate_locations(min, max, Qs[i_q]);
+				vec<Point_d> lowers = {}, uppers = {};
+				for (int j = 0; j < Qs[i_q]; j++) {
+					NumTy side = (max - min) / 100;
+					lowers.push_back(Point_d({ centers[j].x() - side, centers[j].y() - side }));
+					uppers.push_back(Point_d({ centers[j].x() + side, centers[j].y() + side }));
+				}
+
+				auto single_start = chrono::high_resolution_clock::now();
+				long single_count = 0;
+				for (int j = 0; j < Qs[i_q]; j++) {
+					single_count += tree.countInRange(lowers[j], uppers[j]).first;
+				}
+				auto batch_start = chrono::high_resolution_clock::now();
+				auto counts = tree.batchCountInRange(lowers, uppers);
+				auto batch_end = chrono::high_resolution_clock::now();
+
+				if (single_count != accumulate(counts.begin(), counts.end(), 0l)) {
+					cout << "Batched counts do not match single counts." << endl;
+				}
+
+				cout << defaultfloat;
+				cout
+					<< "2D-BATCH-" << Ns[i_n] << "-" << Qs[i_q] << " & "
+					<< chrono::duration_cast<chrono::microseconds>(batch_start - single_start).count() << " & "
+					<< chrono::duration_cast<chrono::microseconds>(batch_end - batch_start).count() << " & "
+					<< "\\\\" << endl;
+			}
+		}
+	}
+
+	// Range trees on N points that merge into a grid of at most 1000 locations, the case where the points are
+	// sorted on the last dimension first and too few remain for redirection tables. Reports the percentage of
+	// counts of random squares equal to a naive count.
+	static void run_2d_duplicates() {
+		vec<int> Ns = { 2000, 10000 };
+		int Q = 1000, side = 30;
+		NumTy min = 0, max = 1000;
+
+		for (int i_n = 0; i_n < Ns.size(); i_n++) {
+			default_random_engine re(chrono::system_clock::now().time_since_epoch().count());
+			uniform_int_distribution<int> rnd_cell(0, side - 1);
+			NumTy spacing = (max - min) / side;
+
+			vec<RangeTree::RTPoint<Color>> points = {};
+			vec<Point_d> locations = {};
+			for (int j = 0; j < Ns[i_n]; j++) {
+				int cx = rnd_cell(re), cy = rnd_cell(re);
+				Point_d location({ min + cx * spacing, min + cy * spacing });
+				// points at the same location need the same value
+				points.push_back(RangeTree::RTPoint<Color>(location, cy * side + cx));
+				locations.push_back(location);
+			}
+			RangeTree::RangeTree<Color> tree(points);
+
+			auto centers = generate_locations(min, max, Q);
+			int exact = 0;
+			for (int j = 0; j < Q; j++) {
+				NumTy half = (max - min) / 10;
+				Point_d lower({ centers[j].x() - half, centers[j].y() - half });
+				Point_d upper({ centers[j].x() + half, centers[j].y() + half });
+				int naive_count = 0;
+				for (auto& p : locations) {
+					if (lower.x() <= p.x() && p.x() <= upper.x() && lower.y() <= p.y() && p.y() <= upper.y()) naive_count++;
+				}
+				if (tree.countInRange(lower, upper).first == naive_count) exact++;
+			}
+
+			cout << defaultfloat;
+			cout
+				<< "2D-DUPLICATES-" << Ns[i_n] << " & "
+				<< fixed << setprecision(1) << 100.0 * exact / Q << " \\\\" << endl;
+		}
+	}
+
+	// Streams updates into a dynamic range tree: N / 2 insertions, then Q rounds of one insertion, one deletion of a
+	// random point and one count of a random square. Reports the times of the insertions, the deletions and the
+	// counts in microseconds, and the percentage of counts equal to a naive count over the remaining points.
+	static void run_2d_dynamic() {
+		vec<int> Ns = { 10000, 100000 };
+		int Q = 1000;
+		NumTy min = 0, max = 1000;
+
+		for (int i_n = 0; i_n < Ns.size(); i_n++) {
+			auto locations = generate_locations(min, max, Ns[i_n] / 2 + Q);
+			auto centers = generate_locations(min, max, Q);
+			default_random_engine re(chrono::system_clock::now().time_since_epoch().count());
+
+			auto insert_start = chrono::high_resolution_clock::now();
+			RangeTree::DynamicRangeTree<Color> tree;
+			vec<Point_d> live = {};
+			for (int j = 0; j < Ns[i_n] / 2; j++) {
+				tree.insert(RangeTree::RTPoint<Color>(locations[j], j % 10));
+				live.push_back(locations[j]);
+			}
+			auto insert_end = chrono::high_resolution_clock::now();
+
+			long update_time = 0, remove_time = 0, count_time = 0;
+			int exact = 0;
+			for (int j = 0; j < Q; j++) {
+				auto update_start = chrono::high_resolution_clock::now();
+				Point_d inserted = locations[Ns[i_n] / 2 + j];
+				tree.insert(RangeTree::RTPoint<Color>(inserted, j % 10));
+				live.push_back(inserted);
+
+				auto remove_start = chrono::high_resolution_clock::now();
+				uniform_int_distribution<int> rnd_index(0, live.size() - 1);
+				int index = rnd_index(re);
+				tree.remove(live[index]);
+				live[index] = live.back();
+				live.pop_back();
+
+				auto count_start = chrono::high_resolution_clock::now();
+				NumTy side = (max - min) / 100;
+				Point_d lower({ centers[j].x() - side, centers[j].y() - side });
+				Point_d upper({ centers[j].x() + side, centers[j].y() + side });
+				int count = tree.countInRange(lower, upper).first;
+				auto count_end = chrono::high_resolution_clock::now();
+
+				update_time += chrono::duration_cast<chrono::microseconds>(remove_start - update_start).count();
+				remove_time += chrono::duration_cast<chrono::microseconds>(count_start - remove_start).count();
+				count_time += chrono::duration_cast<chrono::microseconds>(count_end - count_start).count();
+
+				int naive_count = 0;
+				for (auto& p : live) {
+					if (lower.x() <= p.x() && p.x() <= upper.x() && lower.y() <= p.y() && p.y() <= upper.y()) naive_count++;
+				}
+				if (count == naive_count) exact++;
+			}
+
+			cout << defaultfloat;
+			cout
+				<< "2D-DYNAMIC-" << Ns[i_n] << " & "
+				<< chrono::duration_cast<chrono::microseconds>(insert_end - insert_start).count() << " & "
+				<< update_time << " & "
+				<< remove_time << " & "
+				<< count_time << " & "
+				<< fixed << setprecision(1) << 100.0 * exact / Q << " \\\\" << endl;
+		}
+	}
+
+	static void run_2d_metric() {
+		vec<int> Ns = { 10000, 100000 };
+		vec<int> ks = { 1, 10, 100 };
+		int Q = 10000;
+		NumTy min = 0, max = 1000;
+
+		for (int i_n = 0; i_n < Ns.size(); i_n++) {
+			auto locations = generate_locations(min, max, Ns[i_n]);
+			vec<Color> colors(Ns[i_n]);
+			for (int j = 0; j < Ns[i_n]; j++) colors[j] = j % 10;
+
+			auto store = generate_point_store(&locations, &colors);
+			auto tree = generate_tree(&store);
+			auto duplicates = generate_duplicate_ids(&store);
+			auto query_points = generate_locations(min, max, Q);
+
+			for (int i_k = 0; i_k < ks.size(); i_k++) {
+				auto linf_start = chrono::high_resolution_clock::now();
+				for (int j = 0; j < Q; j++) {
+					query_k_nearest_mode(&tree, &store.sorted_x, &store.sorted_y, &duplicates, &store.colors, query_points[j], ks[i_k], Metric::LInfinity);
+				}
+				auto l2_start = chrono::high_resolution_clock::now();
+				for (int j = 0; j < Q; j++) {
+					query_k_nearest_mode(&tree, &store.sorted_x, &store.sorted_y, &duplicates, &store.colors, query_points[j], ks[i_k], Metric::Euclidean);
+				}
+				auto l2_end = chrono::high_resolution_clock::now();
+
+				cout << defaultfloat;
+				cout
+					<< "2D-METRIC-" << Ns[i_n] << "-" << ks[i_k] << " & "
+					<< chrono::duration_cast<chrono::microseconds>(l2_start - linf_start).count() << " & "
+					<< chrono::duration_cast<chrono::microseconds>(l2_end - l2_start).count() << " & "
+					<< "\\\\" << endl;
+			}
+		}
+	}
+
+	static void run_2d_hint() {
+		vec<int> Ns = { 10000, 100000 };
+		vec<int> ks = { 1, 10, 100 };
+		vec<NumTy> steps = { 0.1, 1, 10 };
+		int Q = 10000;
+		NumTy min = 0, max = 1000;
+		default_random_engine re(chrono::system_clock::now().time_since_epoch().count());
+
+		for (int i_n = 0; i_n < Ns.size(); i_n++) {
+			auto locations = generate_locations(min, max, Ns[i_n]);
+			vec<Color> colors(Ns[i_n], 0);
+			auto store = generate_point_store(&locations, &colors);
+			auto tree = generate_tree(&store);
+
+			for (int i_s = 0; i_s < steps.size(); i_s++) {
+				// a panning view: every query is a small random step away from the previous one
+				uniform_real_distribution<NumTy> rnd_step(-steps[i_s], steps[i_s]);
+				vec<Point_d> query_points = {};
+				NumTy x = (min + max) / 2, y = (min + max) / 2;
+				for (int j = 0; j < Q; j++) {
+					x = std::min(std::max(x + rnd_step(re), min), max);
+					y = std::min(std::max(y + rnd_step(re), min), max);
+					query_points.push_back(Point_d({ x, y }));
+				}
+
+				for (int i_k = 0; i_k < ks.size(); i_k++) {
+					auto plain_start = chrono::high_resolution_clock::now();
+					for (int j = 0; j < Q; j++) {
+						query_k_nearest(&tree, &store.sorted_x, &store.sorted_y, query_points[j], ks[i_k]);
+					}
+					auto hint_start = chrono::high_resolution_clock::now();
+					NumTy hint = 0;
+					for (int j = 0; j < Q; j++) {
+						hint = query_k_nearest(&tree, &store.sorted_x, &store.sorted_y, query_points[j], ks[i_k], hint);
+					}
+					auto hint_end = chrono::high_resolution_clock::now();
+
+					cout << defaultfloat;
+					cout
+						<< "2D-HINT-" << Ns[i_n] << "-" << steps[i_s] << "-" << ks[i_k] << " & "
+						<< chrono::duration_cast<chrono::microseconds>(hint_start - plain_start).count() << " & "
+						<< chrono::duration_cast<chrono::microseconds>(hint_end - hint_start).count() << " & "
+						<< "\\\\" << endl;
+				}
+			}
+		}
+	}
+
+	static void run_2d_engines() {
+		int Q = 10000;
+		string rel_dir = "..\\data\\generated\\";
+		vec<string> files = { "uniform.points", "clustered.points" };
+		vec<pair<string, EngineType>> engines = { { "range tree", EngineType::RangeTree }, { "kd-tree", EngineType::KdTree } };
+		vec<int> ks = { 1, 10, 100 };
+
+		for (int i = 0; i < files.size(); i++) {
+			auto store = read_point_store(rel_dir + files[i]);
+			auto query_points = generate_locations(
+				max(store.sorted_x[1], store.sorted_y[1]),
+				min(store.sorted_x[store.sorted_x.size() - 2], store.sorted_y[store.sorted_y.size() - 2]),
+				Q
+			);
+
+			for (int e = 0; e < engines.size(); e++) {
+				auto build_start = chrono::high_resolution_clock::now();
+				auto engine = create_engine(engines[e].second, &store);
+				auto build_end = chrono::high_resolution_clock::now();
+
+				cout << defaultfloat;
+				cout
+					<< "2D-ENGINE-" << files[i] << "-" << engines[e].first << " & "
+					<< chrono::duration_cast<chrono::microseconds>(build_end - build_start).count();
+
+				for (int i_k = 0; i_k < ks.size(); i_k++) {
+					auto query_start = chrono::high_resolution_clock::now();
+					for (int j = 0; j < Q; j++) {
+						engine->query_k_nearest_mode(query_points[j], ks[i_k], Metric::LInfinity);
+					}
+					auto query_end = chrono::high_resolution_clock::now();
+					cout << " & " << chrono::duration_cast<chrono::microseconds>(query_end - query_start).count();
+				}
+				cout << " & " << "\\\\" << endl;
+			}
+		}
+	}
+
+	static void run_2d_batch_query() {
+		int Q = 100000;
+		int k = 10;
+		string rel_dir = "..\\data\\osm\\";
+		vec<string> files = { "1.points", "2.points", "3.points", "4.points", "5.points", "6.points", "7.points", "8.points", "9.points", "10.points" };
+		vec<unsigned int> thread_counts = { 1, 2, 4, 8, 16, 32 };
+
+		for (int i = 0; i < files.size(); i++) {
+			auto store = read_point_store(rel_dir + files[i]);
+			auto engine = create_engine(EngineType::RangeTree, &store);
+			auto query_points = generate_locations(
+				max(store.sorted_x[1], store.sorted_y[1]),
+				min(store.sorted_x[store.sorted_x.size() - 2], store.sorted_y[store.sorted_y.size() - 2]),
+				Q
+			);
+
+			auto serial_start = chrono::high_resolution_clock::now();
+			for (int j = 0; j < Q; j++) {
+				engine->query_k_nearest_mode(query_points[j], k, Metric::LInfinity);
+			}
+			auto serial_end = chrono::high_resolution_clock::now();
+
+			// throughput in queries per millisecond
+			cout << defaultfloat;
+			cout
+				<< "2D-BATCH-QUERY-" << files[i] << "-" << store.xs.size()
+				<< fixed << setprecision(1) << " & "
+				<< Q / (chrono::duration_cast<chrono::microseconds>(serial_end - serial_start).count() / 1000.0);
+			for (int t = 0; t < thread_counts.size(); t++) {
+				auto batch_start = chrono::high_resolution_clock::now();
+				batch_query_k_nearest_mode(engine.get(), &query_points, k, Metric::LInfinity, thread_counts[t]);
+				auto batch_end = chrono::high_resolution_clock::now();
+				cout << " & " << Q / (chrono::duration_cast<chrono::microseconds>(batch_end - batch_start).count() / 1000.0);
+			}
+			cout << " \\\\" << endl;
+		}
+	}
+
+	// Runs the radius search and chromatic query in more than two dimensions: (x, y, day) on the temperature files,
+	// and uniformly generated points in 4D. Radii are checked against the naive search.
+	static void run_2d_higher_dimensions() {
+		int Q = 1000;
+		vec<int> ks = { 1, 10, 100 };
+		NumTy day_scale = 1; // distance of one day, in degrees
+		string rel_dir = "..\\data\\temperature\\";
+		vec<string> files = {
+			"temperature-02-06-2024.points",
+			"temperature-03-06-2024.points",
+			"temperature-04-06-2024.points",
+			"temperature-05-06-2024.points",
+			"temperature-06-06-2024.points",
+			"temperature-07-06-2024.points",
+			"temperature-08-06-2024.points",
+			"temperature-09-06-2024.points",
+			"temperature-10-06-2024.points",
+			"temperature-11-06-2024.points"
+		};
+
+		vec<pair<string, vec<Point_d>>> datasets = {};
+		vec<vec<Color>> dataset_colors = {};
+
+		vec<Point_d> temperature_locations = {};
+		vec<Color> temperature_colors = {};
+		for (int day = 0; day < files.size(); day++) {
+			auto data = read_file(rel_dir + files[day]);
+			for (int j = 0; j < data.size(); j++) {
+				temperature_locations.push_back(Point_d({ data[j].first.x(), data[j].first.y(), day * day_scale }));
+				temperature_colors.push_back(data[j].second);
+			}
+		}
+		datasets.push_back({ "TMP-3", temperature_locations });
+		dataset_colors.push_back(temperature_colors);
+
+		int N = 100000;
+		default_random_engine re(chrono::system_clock::now().time_since_epoch().count());
+		uniform_real_distribution<NumTy> rnd_pos(0, 1000);
+		uniform_int_distribution<Color> rnd_color(0, 9);
+		vec<Point_d> generated_locations = {};
+		vec<Color> generated_colors = {};
+		for (int j = 0; j < N; j++) {
+			generated_locations.push_back(Point_d({ rnd_pos(re), rnd_pos(re), rnd_pos(re), rnd_pos(re) }));
+			generated_colors.push_back(rnd_color(re));
+		}
+		datasets.push_back({ "GEN-4", generated_locations });
+		dataset_colors.push_back(generated_colors);
+
+		for (int i = 0; i < datasets.size(); i++) {
+			auto locations = &datasets[i].second;
+			auto colors = &dataset_colors[i];
+			int dims = (*locations)[0].dimension();
+
+			auto build_start = chrono::high_resolution_clock::now();
+			auto tree = generate_tree(locations, colors);
+			auto duplicates = generate_duplicate_ids(locations);
+			vec<vec<NumTy>> sorted_values = {};
+			for (int dim = 0; dim < dims; dim++) {
+				auto sorted_pairs = generate_sorted_dim_pairs(locations, dim);
+				sorted_values.push_back(get_sorted_dim_values(&sorted_pairs));
+			}
+			SortedDims sorted = {};
+			for (int dim = 0; dim < dims; dim++) {
+				sorted.push_back(&sorted_values[dim]);
+			}
+			auto build_end = chrono::high_resolution_clock::now();
+
+			// queries within the bounding box of the points
+			vec<Point_d> query_points = {};
+			for (int j = 0; j < Q; j++) {
+				vec<NumTy> coords(dims);
+				for (int dim = 0; dim < dims; dim++) {
+					uniform_real_distribution<NumTy> rnd_coord(sorted_values[dim][1], sorted_values[dim][sorted_values[dim].size() - 2]);
+					coords[dim] = rnd_coord(re);
+				}
+				query_points.push_back(Point_d(coords));
+			}
+
+			cout << defaultfloat;
+			cout
+				<< "2D-DIMS-" << datasets[i].first << "-" << locations->size() << " & "
+				<< chrono::duration_cast<chrono::microseconds>(build_end - build_start).count();
+
+			for (int i_k = 0; i_k < ks.size(); i_k++) {
+				vec<NearestResult> results(Q);
+				auto query_start = chrono::high_resolution_clock::now();
+				for (int j = 0; j < Q; j++) {
+					results[j] = query_k_nearest_mode(&tree, &sorted, &duplicates, colors, query_points[j], ks[i_k]);
+				}
+				auto query_end = chrono::high_resolution_clock::now();
+				cout << " & " << chrono::duration_cast<chrono::microseconds>(query_end - query_start).count();
+
+				for (int j = 0; j < Q; j++) {
+					if (results[j].radius != naive_range(locations, query_points[j], ks[i_k] - 1)) {
+						cout << endl << "Radius does not match naive radius for k = " << ks[i_k] << "." << endl;
+						break;
+					}
+				}
+			}
+			cout << " & " << "\\\\" << endl;
+		}
+	}
+
+	// Accuracy versus latency of the (1 + epsilon)-approximate radius and mode, against the exact engine and naive_range
+	static void run_2d_approximate() {
+		int N = 100000, Q = 1000;
+		vec<int> ks = { 10, 100 };
+		vec<NumTy> epsilons = { 0.01, 0.05, 0.1, 0.25, 0.5 };
+		NumTy min = 0, max = 1000;
+
+		auto locations = generate_locations(min, max, N);
+		vec<Color> colors(N);
+		for (int j = 0; j < N; j++) colors[j] = j % 10;
+		auto store = generate_point_store(&locations, &colors);
+		auto tree = generate_tree(&store);
+		auto duplicates = generate_duplicate_ids(&store);
+		auto query_points = generate_locations(min, max, Q);
+
+		for (int i_k = 0; i_k < ks.size(); i_k++) {
+			int k = ks[i_k];
+			vec<NumTy> naive_radii = {};
+			for (int j = 0; j < Q; j++) {
+				naive_radii.push_back(naive_range(&locations, query_points[j], k - 1));
+			}
+
+			vec<NearestResult> exact(Q);
+			auto exact_start = chrono::high_resolution_clock::now();
+			for (int j = 0; j < Q; j++) {
+				exact[j] = query_k_nearest_mode(&tree, &store.sorted_x, &store.sorted_y, &duplicates, &store.colors, query_points[j], k);
+			}
+			auto exact_end = chrono::high_resolution_clock::now();
+
+			cout << defaultfloat;
+			cout << "2D-APPROX-" << N << "-" << k << "-exact & " << chrono::duration_cast<chrono::microseconds>(exact_end - exact_start).count() << " \\\\" << endl;
+
+			for (int i_e = 0; i_e < epsilons.size(); i_e++) {
+				vec<ApproximateResult> approximate(Q);
+				auto approximate_start = chrono::high_resolution_clock::now();
+				for (int j = 0; j < Q; j++) {
+					approximate[j] = query_approximate_k_nearest_mode(&tree, &store.sorted_x, &store.sorted_y, &duplicates, &store.colors, query_points[j], k, epsilons[i_e]);
+				}
+				auto approximate_end = chrono::high_resolution_clock::now();
+
+				// ratio of the approximate to the naive radius, and how often the mode colors agree
+				NumTy sum_ratio = 0, max_ratio = 1;
+				int same_mode = 0;
+				for (int j = 0; j < Q; j++) {
+					NumTy ratio = naive_radii[j] > 0 ? approximate[j].radius / naive_radii[j] : 1;
+					sum_ratio += ratio;
+					max_ratio = std::max(max_ratio, ratio);
+					if (approximate[j].mode == exact[j].mode) same_mode++;
+				}
+
+				cout
+					<< "2D-APPROX-" << N << "-" << k << "-" << epsilons[i_e] << " & "
+					<< chrono::duration_cast<chrono::microseconds>(approximate_end - approximate_start).count()
+					<< fixed << setprecision(4) << " & "
+					<< sum_ratio / Q << " & "
+					<< max_ratio << " & "
+					<< setprecision(1) << 100.0 * same_mode / Q << " \\\\" << endl;
+				cout << defaultfloat;
+			}
+		}
+	}
+
+	// Get the mode of the dual lines below q by checking all of them
+	static pair<Color, int> naive_dual_mode(vec<Segment_2>* segments, vec<Color>* colors, Point_2 q) {
+		map<Color, int> candidate_modes;
+		for (int i = 0; i < segments->size(); i++) {
+			if (is_below((*segments)[i], q)) candidate_modes[(*colors)[i]]++;
+		}
+		if (candidate_modes.empty()) return pair<Color, int>(-1, 0);
+
+		return *max_element(
+			begin(candidate_modes),
+			end(candidate_modes),
+			[](const pair<Color, int> a, const pair<Color, int> b) { return a.second < b.second; }
+		);
+	}
+
+	// Flat r-cutting against a cutting tree of r-cuttings on the temperature data, for the r values of run_2d_real.
+	// Reports build and query times in microseconds, the number of nodes and faces of the tree, and the percentages
+	// of flat and of tree queries whose frequency matches naive_dual_mode.
+	static void run_2d_cutting_tree() {
+		int Q = 1000;
+		auto files = get_mode_benchmark_files();
+		vec<int> rs = { 2, 5, 10, 15, 20 };
+		vec<int> leaf_sizes = { 16, 64 };
+
+		for (int i = 0; i < files.size(); i++) {
+			auto store = read_point_store(files[i]);
+			auto primal_points = get_primal_query_points(&store, Q);
+
+			for (int i_r = 0; i_r < rs.size(); i_r++) {
+				auto flat_start = chrono::high_resolution_clock::now();
+				ModeData md = preprocess_mode(&store.xs, &store.ys, &store.colors, rs[i_r]);
+				Trapezoid_pl tpl(md.arr);
+				auto flat_end = chrono::high_resolution_clock::now();
+
+				auto query_points = get_dual_queries(&md.transform, &primal_points);
+
+				auto flat_query_start = chrono::high_resolution_clock::now();
+				vec<pair<int, int>> flat_modes(Q);
+				for (int j = 0; j < Q; j++) {
+					flat_modes[j] = query_arrangement(&md, &tpl, &store.colors, query_points[j]);
+				}
+				auto flat_query_end = chrono::high_resolution_clock::now();
+
+				int flat_exact = 0;
+				for (int j = 0; j < Q; j++) {
+					if (flat_modes[j].second == naive_dual_mode(&md.segments, &store.colors, query_points[j]).second) flat_exact++;
+				}
+
+				for (int i_l = 0; i_l < leaf_sizes.size(); i_l++) {
+					auto tree_start = chrono::high_resolution_clock::now();
+					auto tree = preprocess_cutting_tree(&store.xs, &store.ys, &store.colors, rs[i_r], leaf_sizes[i_l]);
+					auto tree_end = chrono::high_resolution_clock::now();
+
+					vec<pair<int, int>> modes(Q);
+					for (int j = 0; j < Q; j++) {
+						modes[j] = query_cutting_tree(&tree, query_points[j]);
+					}
+					auto tree_query_end = chrono::high_resolution_clock::now();
+
+					int exact = 0;
+					for (int j = 0; j < Q; j++) {
+						if (modes[j].second == naive_dual_mode(&tree.segments, &store.colors, query_points[j]).second) exact++;
+					}
+					long faces = 0;
+					for (auto& node : tree.nodes) {
+						faces += node->arr.number_of_faces();
+					}
+
+					cout << defaultfloat;
+					cout
+						<< "2D-CUT-" << i
+						<< "-" << rs[i_r]
+						<< "-" << leaf_sizes[i_l] << " & "
+						<< chrono::duration_cast<chrono::microseconds>(flat_end - flat_start).count() << " & "
+						<< chrono::duration_cast<chrono::microseconds>(flat_query_end - flat_query_start).count() << " & "
+						<< chrono::duration_cast<chrono::microseconds>(tree_end - tree_start).count() << " & "
+						<< chrono::duration_cast<chrono::microseconds>(tree_query_end - tree_end).count() << " & "
+						<< tree.nodes.size() << " & "
+						<< faces << " & "
+						<< fixed << setprecision(1) << 100.0 * flat_exact / Q << " & "
+						<< 100.0 * exact / Q << " \\\\" << endl;
+				}
+			}
+			cout << "\\hline \\\\" << endl;
+		}
+	}
+
+	// Per query point location against one batched sweep on the temperature data, for the r values of run_2d_real.
+	// Reports the query times in microseconds for both, and the percentage of batch answers equal to the single ones.
+	static void run_2d_batch_mode() {
+		int Q = 10000;
+		auto files = get_mode_benchmark_files();
+		vec<int> rs = { 2, 5, 10, 15, 20 };
+
+		for (int i = 0; i < files.size(); i++) {
+			auto store = read_point_store(files[i]);
+			auto primal_points = get_primal_query_points(&store, Q);
+
+			for (int i_r = 0; i_r < rs.size(); i_r++) {
+				ModeData md = preprocess_mode(&store.xs, &store.ys, &store.colors, rs[i_r]);
+				Trapezoid_pl tpl(md.arr);
+				auto query_points = get_dual_queries(&md.transform, &primal_points);
+
+				auto single_start = chrono::high_resolution_clock::now();
+				vec<pair<int, int>> single_modes(Q);
+				for (int j = 0; j < Q; j++) {
+					single_modes[j] = query_arrangement(&md, &tpl, &store.colors, query_points[j]);
+				}
+				auto single_end = chrono::high_resolution_clock::now();
+				auto batch_modes = batch_query_arrangement(&md, &store.colors, &query_points);
+				auto batch_end = chrono::high_resolution_clock::now();
+
+				int equal = 0;
+				for (int j = 0; j < Q; j++) {
+					if (batch_modes[j] == single_modes[j]) equal++;
+				}
+
+				cout << defaultfloat;
+				cout
+					<< "2D-BATCH-" << i
+					<< "-" << rs[i_r] << " & "
+					<< chrono::duration_cast<chrono::microseconds>(single_end - single_start).count() << " & "
+					<< chrono::duration_cast<chrono::microseconds>(batch_end - single_end).count() << " & "
+					<< fixed << setprecision(1) << 100.0 * equal / Q << " \\\\" << endl;
+			}
+			cout << "\\hline \\\\" << endl;
+		}
+	}
+
+	// Point location strategies for mode queries on the temperature data, for the r values of run_2d_real. Reports
+	// the build and query times in microseconds of each, and the percentage of answers equal to the trapezoidal map.
+	static void run_2d_point_location() {
+		int Q = 10000;
+		auto files = get_mode_benchmark_files();
+		vec<int> rs = { 2, 5, 10, 15, 20 };
+		vec<PointLocationKind> kinds = { TRAPEZOID_RIC, LANDMARKS, GRID };
+		vec<string> kind_names = { "TRAPEZOID", "LANDMARKS", "GRID" };
+
+		for (int i = 0; i < files.size(); i++) {
+			auto store = read_point_store(files[i]);
+			auto primal_points = get_primal_query_points(&store, Q);
+
+			for (int i_r = 0; i_r < rs.size(); i_r++) {
+				ModeData md = preprocess_mode(&store.xs, &store.ys, &store.colors, rs[i_r]);
+				auto query_points = get_dual_queries(&md.transform, &primal_points);
+
+				vec<pair<int, int>> reference_modes = {};
+				for (int i_k = 0; i_k < kinds.size(); i_k++) {
+					auto build_start = chrono::high_resolution_clock::now();
+					FaceLocator locator = build_face_locator(&md, kinds[i_k]);
+					auto build_end = chrono::high_resolution_clock::now();
+
+					vec<pair<int, int>> modes(Q);
+					for (int j = 0; j < Q; j++) {
+						modes[j] = query_arrangement(&md, &locator, &store.colors, query_points[j]);
+					}
+					auto query_end = chrono::high_resolution_clock::now();
+					if (i_k == 0) reference_modes = modes;
+
+					int equal = 0;
+					for (int j = 0; j < Q; j++) {
+						if (modes[j] == reference_modes[j]) equal++;
+					}
+
+					cout << defaultfloat;
+					cout
+						<< "2D-PL-" << i
+						<< "-" << rs[i_r]
+						<< "-" << kind_names[i_k] << " & "
+						<< md.arr.number_of_faces() << " & "
+						<< chrono::duration_cast<chrono::microseconds>(build_end - build_start).count() << " & "
+						<< chrono::duration_cast<chrono::microseconds>(query_end - build_end).count() << " & "
+						<< fixed << setprecision(1) << 100.0 * equal / Q << " \\\\" << endl;
+				}
+			}
+			cout << "\\hline \\\\" << endl;
+		}
+	}
+
 	static void run_2d_generated() {
 		int num_runs = 1;
 		vec<vec<NumTy>> scenarios = {